@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include "arena.h"
+
+void arena_init(arena_t *a, size_t size, size_t len)
+{
+	// keep every object aligned for pointers and longs
+	a->size = (size+sizeof(void *)-1)/sizeof(void *)*sizeof(void *);
+	a->len = len;
+	a->chunks = NULL;
+}
+
+void *arena_alloc(arena_t *a)
+{
+	arena_chunk_t *c = a->chunks;
+	if (!c || c->used==a->len)
+	{
+		c = (arena_chunk_t *)malloc(sizeof(arena_chunk_t)+a->size*a->len);
+		if (!c)
+			return NULL;
+		c->next = a->chunks;
+		c->used = 0;
+		a->chunks = c;
+	}
+	return c->data+a->size*c->used++;
+}
+
+// visits every object allocated so far, in allocation order within each chunk
+void arena_walk(arena_t *a, void (*func)(void *obj))
+{
+	arena_chunk_t *c;
+	size_t i;
+	for (c=a->chunks; c!=NULL; c=c->next)
+		for (i=0; i<c->used; i++)
+			func(c->data+a->size*i);
+}
+
+void arena_destroy(arena_t *a)
+{
+	arena_chunk_t *c, *next;
+	for (c=a->chunks; c!=NULL; c=next)
+	{
+		next = c->next;
+		free(c);
+	}
+	a->chunks = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// chunked allocator of fixed size objects. objects are never freed one by one.
+// the whole arena goes at once, in as many calls to free as it has chunks
+typedef struct arena_chunk
+{
+	struct arena_chunk *next;
+	size_t used;
+	char data[];
+} arena_chunk_t;
+
+typedef struct
+{
+	size_t size; // object size
+	size_t len; // objects per chunk
+	arena_chunk_t *chunks; // newest first
+} arena_t;
+
+void arena_init(arena_t *a, size_t size, size_t len);
+void *arena_alloc(arena_t *a);
+void arena_walk(arena_t *a, void (*func)(void *obj));
+void arena_destroy(arena_t *a);
+
+#endif
@@ -1,42 +1,634 @@
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include "bitset.h"
+#include "pool.h"
 
-bitset_bag_t *bitset_bag_create(itemset_bag_t *ibag)
+// items transposed at once
+#define BITSET_BATCH	(1L<<22)
+// item ranges per thread when parts are merged
+#define BITSET_MERGE_CHUNKS	4
+// bitsets an auto tuning samples, cut to the tids of this many first transactions
+#define BITSET_TUNE_SAMPLE	32
+#define BITSET_TUNE_TRAN	(1L<<19)
+// time every backend gets for intersecting the sample
+#define BITSET_TUNE_NS	20000000L
+// a backend whose bitsets take this many times the memory of the smallest is not chosen
+#define BITSET_TUNE_BLOWUP	8
+
+// transposes transactions a batch at a time, so that every bitmap gets its tids in sorted runs
+// through one bulk add instead of one add per tid
+typedef struct
+{
+	bitset_bag_t *bag;
+	double minsupf; // of the items that get a bitmap when scanning
+	long cap; // items that count and pos have room for
+	long *count; // tids of each item in the batch
+	long *pos; // where the next tid of each item goes
+	long tcap;
+	int *touched; // items that occur in the batch
+	uint32_t *tids;
+} bitset_batch_t;
+
+// makes room for n items in a batch and for every item of the bag
+int bitset_batch_reserve(bitset_batch_t *b, long n)
+{
+	if (n > b->tcap)
+	{
+		int *touched = (int *)realloc(b->touched, n*sizeof(int));
+		if (!touched)
+			return -1;
+		b->touched = touched;
+		uint32_t *tids = (uint32_t *)realloc(b->tids, n*sizeof(uint32_t));
+		if (!tids)
+			return -1;
+		b->tids = tids;
+		b->tcap = n;
+	}
+	if (b->bag->cap > b->cap)
+	{
+		long *count = (long *)realloc(b->count, b->bag->cap*sizeof(long));
+		if (!count)
+			return -1;
+		b->count = count;
+		memset(b->count+b->cap, 0, (b->bag->cap-b->cap)*sizeof(long));
+		long *pos = (long *)realloc(b->pos, b->bag->cap*sizeof(long));
+		if (!pos)
+			return -1;
+		b->pos = pos;
+		b->cap = b->bag->cap;
+	}
+	return 0;
+}
+
+// adds the n transactions of offsets and items to the bitmaps, the first one as tid
+int bitset_batch_flush(bitset_batch_t *b, long *offsets, int *items, long n, long tid)
+{
+	long i, j, p, ntouched = 0;
+	bitset_t *bitsets = b->bag->bitsets;
+	
+	if (bitset_batch_reserve(b, offsets[n]-offsets[0]))
+		return -1;
+	// infrequent items have no bitmap. items of a binary dataset are checked here, as they
+	// are used
+	for (j=offsets[0]; j<offsets[n]; j++)
+	{
+		if ((unsigned)items[j] >= (unsigned)b->bag->len)
+			return -1;
+		if (bitsets[items[j]].bitmap && b->count[items[j]]++ == 0)
+			b->touched[ntouched++] = items[j];
+	}
+	for (i=0, p=0; i<ntouched; i++)
+	{
+		b->pos[b->touched[i]] = p;
+		p += b->count[b->touched[i]];
+	}
+	for (i=0; i<n; i++)
+		for (j=offsets[i]; j<offsets[i+1]; j++)
+			if (bitsets[items[j]].bitmap)
+				b->tids[b->pos[items[j]]++] = tid+i;
+	for (i=0; i<ntouched; i++)
+	{
+		int t = b->touched[i];
+		wrapped_bitmap_add_many(bitsets[t].bitmap, b->tids+b->pos[t]-b->count[t], b->count[t]);
+		bitsets[t].card += b->count[t];
+		b->count[t] = 0;
+	}
+	return 0;
+}
+
+void bitset_batch_free(bitset_batch_t *b)
+{
+	free(b->count);
+	free(b->pos);
+	free(b->touched);
+	free(b->tids);
+}
+
+// sets up a bitset for every item up to item_max. only items with at least minsup
+// supports get a bitmap. the others keep their support as cardinality
+int bitset_bag_init(bitset_bag_t *bag, long *supports, int item_max, long minsup)
+{
+	long i;
+	
+	bag->bitsets = (bitset_t *)malloc((item_max+1)*sizeof(bitset_t));
+	if (!bag->bitsets)
+		return -1;
+	bag->cap = item_max+1;
+	for (i=0; i<item_max+1; i++)
+	{
+		long sup = supports? supports[i]: 0;
+		bag->bitsets[i].bitmap = NULL;
+		bag->bitsets[i].card = sup>=minsup? 0: sup;
+		bag->len++;
+		if (sup>=minsup && !(bag->bitsets[i].bitmap=wrapped_bitmap_create()))
+			return -1;
+	}
+	return 0;
+}
+
+// a range of transactions whose bitmaps are built apart, with their own tids
+typedef struct
+{
+	bitset_bag_t *bag;
+	itemset_bag_t *ibag;
+	long first;
+	long last;
+	int error;
+} bitset_part_t;
+
+// a range of items whose bitmaps are merged from the parts
+typedef struct
+{
+	bitset_part_t *parts;
+	int nparts;
+	long first;
+	long last;
+} bitset_merge_t;
+
+void bitset_part_build(void *arg, int worker)
 {
+	bitset_part_t *p = (bitset_part_t *)arg;
+	itemset_bag_t *ibag = p->ibag;
+	bitset_batch_t batch;
 	long i, j;
 	
-	bitset_bag_t *bbag;
+	memset(&batch, 0, sizeof(batch));
+	batch.bag = p->bag;
+	for (i=p->first; i<p->last; i=j)
+	{
+		for (j=i+1; j<p->last && ibag->offsets[j+1]-ibag->offsets[i]<=BITSET_BATCH; j++)
+			;
+		if (bitset_batch_flush(&batch, ibag->offsets+i, ibag->items, j-i, i))
+		{
+			p->error = 1;
+			break;
+		}
+	}
+	bitset_batch_free(&batch);
+}
+
+// the parts cover ascending tid ranges, so or-ing them in order appends them
+void bitset_part_merge(void *arg, int worker)
+{
+	bitset_merge_t *m = (bitset_merge_t *)arg;
+	bitset_t *bitsets = m->parts[0].bag->bitsets;
+	long i;
+	int k;
 	
-	bbag = (bitset_bag_t *)malloc(sizeof(bitset_bag_t));
-	if (!bbag)
+	for (i=m->first; i<m->last; i++)
+		for (k=1; k<m->nparts && bitsets[i].bitmap; k++)
+		{
+			bitset_t *b = m->parts[k].bag->bitsets+i;
+			wrapped_bitmap_or_inplace(bitsets[i].bitmap, b->bitmap);
+			bitsets[i].card += b->card;
+			bitset_free(b);
+			b->bitmap = NULL;
+		}
+}
+
+// an empty bag with a bitmap for the same items as bag
+bitset_bag_t *bitset_bag_part(bitset_bag_t *bag)
+{
+	long i;
+	bitset_bag_t *part = (bitset_bag_t *)calloc(1, sizeof(bitset_bag_t));
+	if (!part)
 		goto e1;
-	
-	bbag->len = 0;
-	bbag->bitsets = (bitset_t *)malloc((ibag->item_max+1)*sizeof(bitset_t));
-	if (!bbag->bitsets)
+	part->bitsets = (bitset_t *)calloc(bag->len, sizeof(bitset_t));
+	if (!part->bitsets)
 		goto e2;
-	for (i=0; i<ibag->item_max+1; i++)
+	part->cap = bag->len;
+	for (i=0; i<bag->len; i++)
 	{
-		bbag->bitsets[i].bitmap = wrapped_bitmap_create();
-		bbag->bitsets[i].card = 0;
-		if (!bbag->bitsets[i].bitmap)
+		part->len++;
+		if (bag->bitsets[i].bitmap && !(part->bitsets[i].bitmap=wrapped_bitmap_create()))
 			goto e2;
-		bbag->len++;
 	}
-	for (i=0; i<ibag->len; i++)
-		for (j=0; j<ibag->itemsets[i].len; j++)
+	return part;
+
+e2:
+	bitset_bag_free(part);
+e1:
+	return NULL;
+}
+
+// builds the bitmaps of ibag into bag. with more than one thread, every thread builds the
+// bitmaps of a range of transactions with about the same number of items, and the ranges
+// are merged item by item
+int bitset_bag_build(bitset_bag_t *bag, itemset_bag_t *ibag, int nthreads)
+{
+	long i, n, lo, hi, nitem = ibag->offsets[ibag->len]-ibag->offsets[0];
+	int k, nparts = nthreads>1 && ibag->len>=nthreads? nthreads: 1, r = -1;
+	bitset_part_t *parts;
+	bitset_merge_t *merges = NULL;
+	pool_t *pool = NULL;
+	
+	parts = (bitset_part_t *)calloc(nparts, sizeof(bitset_part_t));
+	if (!parts)
+		goto e1;
+	for (k=0; k<nparts; k++)
+	{
+		parts[k].bag = k? bitset_bag_part(bag): bag;
+		if (!parts[k].bag)
+			goto e2;
+		parts[k].ibag = ibag;
+		parts[k].first = k? parts[k-1].last: 0;
+		// the first transaction that starts past the share of items of the parts so far
+		for (lo=parts[k].first, hi=ibag->len; k<nparts-1 && lo<hi; )
 		{
-			wrapped_bitmap_add(bbag->bitsets[ibag->itemsets[i].items[j]].bitmap, i);
-			bbag->bitsets[ibag->itemsets[i].items[j]].card++;
+			long mid = (lo+hi)/2;
+			if (ibag->offsets[mid]-ibag->offsets[0] < nitem*(k+1)/nparts)
+				lo = mid+1;
+			else
+				hi = mid;
 		}
+		parts[k].last = k<nparts-1? lo: ibag->len;
+	}
+	if (nparts == 1)
+	{
+		bitset_part_build(parts, 0);
+		r = parts[0].error? -1: 0;
+		goto e2;
+	}
+	
+	pool = pool_create(nthreads);
+	if (!pool)
+		goto e2;
+	for (k=0; k<nparts; k++)
+		pool_submit(pool, bitset_part_build, parts+k);
+	pool_run(pool);
+	for (k=0; k<nparts; k++)
+		if (parts[k].error)
+			goto e3;
+	
+	n = nthreads*BITSET_MERGE_CHUNKS;
+	merges = (bitset_merge_t *)malloc(n*sizeof(bitset_merge_t));
+	if (!merges)
+		goto e3;
+	for (i=0; i<n; i++)
+	{
+		merges[i].parts = parts;
+		merges[i].nparts = nparts;
+		merges[i].first = bag->len*i/n;
+		merges[i].last = bag->len*(i+1)/n;
+		pool_submit(pool, bitset_part_merge, merges+i);
+	}
+	pool_run(pool);
+	r = 0;
+	
+	free(merges);
+e3:
+	pool_free(pool);
+e2:
+	for (k=1; k<nparts; k++)
+		if (parts[k].bag)
+			bitset_bag_free(parts[k].bag);
+	free(parts);
+e1:
+	return r;
+}
+
+// builds the bitsets of the items with at least minsup supports on nthreads threads
+bitset_bag_t *bitset_bag_create(itemset_bag_t *ibag, long minsup, int nthreads)
+{
+	long j;
+	long *supports = ibag->supports;
+	bitset_bag_t *bbag;
+	
+	bbag = (bitset_bag_t *)calloc(1, sizeof(bitset_bag_t));
+	if (!bbag)
+		goto e1;
+	bbag->ntran = ibag->len;
+	if (!supports && minsup > 0)
+	{
+		// binary datasets without supports count them here
+		supports = (long *)calloc(ibag->item_max+1, sizeof(long));
+		if (!supports)
+			goto e2;
+		for (j=ibag->offsets[0]; j<ibag->offsets[ibag->len]; j++)
+		{
+			if ((unsigned)ibag->items[j] > (unsigned)ibag->item_max)
+				goto e3;
+			supports[ibag->items[j]]++;
+		}
+	}
+	if (bitset_bag_init(bbag, supports, ibag->item_max, minsup))
+		goto e3;
+	if (ibag->ids)
+	{
+		bbag->ids = (int *)malloc((ibag->item_max+1)*sizeof(int));
+		if (!bbag->ids)
+			goto e3;
+		memcpy(bbag->ids, ibag->ids, (ibag->item_max+1)*sizeof(int));
+	}
+	if (supports != ibag->supports)
+		free(supports);
+	
+	if (bitset_bag_build(bbag, ibag, nthreads))
+		goto e2;
 	return bbag;
 	
+e3:
+	if (supports != ibag->supports)
+		free(supports);
 e2:
 	bitset_bag_free(bbag);
 e1:
 	return NULL;
 }
 
+// sets up the bitsets of a scan once the supports of its items are counted. only the items
+// with at least a fraction minsupf of the transactions get a bitmap
+int bitset_bag_start(void *arg, itemset_bag_t *head, long tid)
+{
+	bitset_batch_t *b = (bitset_batch_t *)arg;
+	bitset_bag_t *bag = b->bag;
+	
+	bag->ntran = head->len;
+	if (bitset_bag_init(bag, head->supports, head->item_max, (long)ceil(b->minsupf*head->len)))
+		return -1;
+	if (head->ids)
+	{
+		bag->ids = (int *)malloc((head->item_max+1)*sizeof(int));
+		if (!bag->ids)
+			return -1;
+		memcpy(bag->ids, head->ids, (head->item_max+1)*sizeof(int));
+	}
+	return 0;
+}
+
+// adds the transactions of a part of a scan to the bitmaps a batch at a time
+int bitset_bag_add(void *arg, itemset_bag_t *part, long tid)
+{
+	bitset_batch_t *b = (bitset_batch_t *)arg;
+	long i, j;
+	
+	for (i=0; i<part->len; i=j)
+	{
+		for (j=i+1; j<part->len && part->offsets[j+1]-part->offsets[i]<=BITSET_BATCH; j++)
+			;
+		if (bitset_batch_flush(b, part->offsets+i, part->items, j-i, tid+i))
+			return -1;
+	}
+	return 0;
+}
+
+// builds the bitsets while reading the dataset on nthreads threads, without keeping its
+// transactions. items with less than a fraction minsupf of the transactions get no bitmap
+bitset_bag_t *bitset_bag_load(char *path, double frac, double minsupf, int nthreads)
+{
+	bitset_batch_t batch;
+	bitset_bag_t *bbag;
+	
+	bbag = (bitset_bag_t *)calloc(1, sizeof(bitset_bag_t));
+	if (!bbag)
+		goto e1;
+	memset(&batch, 0, sizeof(batch));
+	batch.bag = bbag;
+	batch.minsupf = minsupf;
+	if (itemset_scan(path, frac, nthreads, bitset_bag_start, bitset_bag_add, &batch) < 0)
+		goto e2;
+	bitset_batch_free(&batch);
+	return bbag;
+
+e2:
+	bitset_batch_free(&batch);
+	bitset_bag_free(bbag);
+e1:
+	return NULL;
+}
+
+// a range of items whose bitmaps are optimized
+typedef struct
+{
+	bitset_bag_t *bag;
+	long first;
+	long last;
+	long saved;
+} bitset_optimize_t;
+
+void bitset_range_optimize(void *arg, int worker)
+{
+	bitset_optimize_t *o = (bitset_optimize_t *)arg;
+	long i;
+	for (i=o->first; i<o->last; i++)
+		if (o->bag->bitsets[i].bitmap)
+			o->saved += wrapped_bitmap_optimize(o->bag->bitsets[i].bitmap);
+}
+
+// optimizes all bitmaps of the bag on nthreads threads. returns the bytes saved, or -1
+long bitset_bag_optimize(bitset_bag_t *bag, int nthreads)
+{
+	long i, n = nthreads*BITSET_MERGE_CHUNKS, saved = 0;
+	bitset_optimize_t *ranges;
+	pool_t *pool = NULL;
+
+	ranges = (bitset_optimize_t *)malloc(n*sizeof(bitset_optimize_t));
+	if (!ranges)
+		goto e1;
+	if (nthreads>1 && !(pool=pool_create(nthreads)))
+		goto e2;
+	for (i=0; i<n; i++)
+	{
+		ranges[i].bag = bag;
+		ranges[i].first = bag->len*i/n;
+		ranges[i].last = bag->len*(i+1)/n;
+		ranges[i].saved = 0;
+		if (pool)
+			pool_submit(pool, bitset_range_optimize, ranges+i);
+		else
+			bitset_range_optimize(ranges+i, 0);
+	}
+	if (pool)
+	{
+		pool_run(pool);
+		pool_free(pool);
+	}
+	for (i=0; i<n; i++)
+		saved += ranges[i].saved;
+	free(ranges);
+	return saved;
+
+e2:
+	free(ranges);
+e1:
+	return -1;
+}
+
+long bitset_tune_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000L+t.tv_nsec;
+}
+
+int bitset_tune_cmp(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return x<y? -1: x>y;
+}
+
+// intersects the sample pair by pair the way mining does, counting first and building the
+// frequent ones, until the time is up. returns ns per intersection
+double bitset_tune_run(wrapped_bitmap_t **sample, int n, long minsup)
+{
+	long start = bitset_tune_now(), ops = 0, t;
+	wrapped_bitmap_t *r;
+	int i, j;
+
+	for (;;)
+		for (i=0; i<n; i++)
+			for (j=i+1; j<n; j++)
+			{
+				ops++;
+				if (wrapped_bitmap_and_cardinality(sample[i], sample[j]) >= minsup)
+				{
+					r = wrapped_bitmap_and(sample[i], sample[j]);
+					if (!r)
+						return -1;
+					// the next level intersects results
+					wrapped_bitmap_and_cardinality(r, sample[(i+j)%n]);
+					wrapped_bitmap_free(r);
+					ops += 2;
+				}
+				t = bitset_tune_now()-start;
+				if (t >= BITSET_TUNE_NS)
+					return (double)t/ops;
+			}
+}
+
+// the tids of the sample are built into bitmaps of every backend and intersected. the
+// minimum support is scaled to the transactions of the sample
+int bitset_tune_measure(uint32_t **tids, long *lens, int n, long minsup, long ntran, bitset_tune_t *tune)
+{
+	const char *current = wrapped_bitmap_backend();
+	const char *name;
+	wrapped_bitmap_t *sample[BITSET_TUNE_SAMPLE];
+	bitset_cost_t *c;
+	int b, i, r = -1;
+	long sup = ntran>BITSET_TUNE_TRAN? (long)((double)minsup*BITSET_TUNE_TRAN/ntran): minsup;
+
+	for (b=0; (name=wrapped_bitmap_backend_at(b)) && b<BITSET_TUNE_MAX; b++)
+	{
+		c = tune->costs+tune->ncost;
+		c->backend = name;
+		c->bytes = 0;
+		wrapped_bitmap_select(name);
+		for (i=0; i<n; i++)
+		{
+			if (!(sample[i]=wrapped_bitmap_create()))
+				goto e1;
+			wrapped_bitmap_add_many(sample[i], tids[i], lens[i]);
+			wrapped_bitmap_optimize(sample[i]);
+			c->bytes += wrapped_bitmap_serialize_size(sample[i]);
+		}
+		c->ns = bitset_tune_run(sample, n, sup);
+		for (i=0; i<n; i++)
+			wrapped_bitmap_free(sample[i]);
+		if (c->ns < 0)
+			goto e2;
+		// the sample stands for all frequent bitsets and all transactions
+		c->bytes = (size_t)((double)c->bytes*tune->len/n*ntran/(ntran<BITSET_TUNE_TRAN? ntran: BITSET_TUNE_TRAN));
+		tune->ncost++;
+	}
+	r = 0;
+	goto e2;
+
+e1:
+	while (i--)
+		wrapped_bitmap_free(sample[i]);
+e2:
+	wrapped_bitmap_select(current);
+	return r;
+}
+
+// profiles the frequent bitsets, measures every backend on a sample of them and moves the bag
+// to the fastest that does not take much more memory than the others, which is selected then
+// and optimizes the moved bitmaps. it stays where it is with fewer than two to sample.
+// a bag that fails to move is lost
+int bitset_bag_tune(bitset_bag_t *bag, long minsup, bitset_tune_t *tune)
+{
+	uint32_t *tids[BITSET_TUNE_SAMPLE], *buf = NULL;
+	long lens[BITSET_TUNE_SAMPLE], *cards, tot = 0, runs = 0, n = 0, k;
+	int i, j, r = -1;
+	const char *best;
+	size_t small;
+
+	memset(tune, 0, sizeof(bitset_tune_t));
+	tune->best = -1;
+	cards = (long *)malloc((bag->len+1)*sizeof(long));
+	if (!cards)
+		goto e1;
+	for (i=0; i<bag->len; i++)
+		if (bag->bitsets[i].bitmap && bag->bitsets[i].card>=minsup)
+			cards[tune->len++] = bag->bitsets[i].card;
+	if (tune->len < 2)
+	{
+		r = 0;
+		goto e2;
+	}
+	qsort(cards, tune->len, sizeof(long), bitset_tune_cmp);
+	tune->min = cards[0];
+	tune->median = cards[tune->len/2];
+	tune->max = cards[tune->len-1];
+	tune->nsample = tune->len<BITSET_TUNE_SAMPLE? tune->len: BITSET_TUNE_SAMPLE;
+	buf = (uint32_t *)malloc(tune->max*sizeof(uint32_t)+1);
+	if (!buf)
+		goto e2;
+
+	// frequent bitsets spread evenly over the items, cut to the first transactions
+	for (i=0, j=0; i<bag->len && n<tune->nsample; i++)
+	{
+		if (!bag->bitsets[i].bitmap || bag->bitsets[i].card<minsup)
+			continue;
+		if (j++ != n*tune->len/tune->nsample)
+			continue;
+		wrapped_bitmap_to_array(bag->bitsets[i].bitmap, buf);
+		for (k=0; k<bag->bitsets[i].card && buf[k]<BITSET_TUNE_TRAN; k++)
+			if (k==0 || buf[k]!=buf[k-1]+1)
+				runs++;
+		lens[n] = k;
+		tids[n] = (uint32_t *)malloc(k*sizeof(uint32_t)+1);
+		if (!tids[n])
+			goto e3;
+		memcpy(tids[n], buf, k*sizeof(uint32_t));
+		tot += k;
+		n++;
+	}
+	tune->density = (double)tot/n/(bag->ntran<BITSET_TUNE_TRAN? bag->ntran: BITSET_TUNE_TRAN);
+	tune->run = runs? (double)tot/runs: 0;
+	if (bitset_tune_measure(tids, lens, n, minsup, bag->ntran, tune) || !tune->ncost)
+		goto e3;
+	small = tune->costs[0].bytes;
+	for (i=1; i<tune->ncost; i++)
+		if (tune->costs[i].bytes < small)
+			small = tune->costs[i].bytes;
+	for (i=0; i<tune->ncost; i++)
+		if (tune->costs[i].bytes<=BITSET_TUNE_BLOWUP*small && (tune->best<0 || tune->costs[i].ns<tune->costs[tune->best].ns))
+			tune->best = i;
+
+	best = tune->costs[tune->best].backend;
+	if (strcmp(best, wrapped_bitmap_backend()))
+	{
+		for (i=0; i<bag->len; i++)
+			if (bag->bitsets[i].bitmap && !(bag->bitsets[i].bitmap=wrapped_bitmap_move(bag->bitsets[i].bitmap, best)))
+				goto e3;
+		wrapped_bitmap_select(best);
+		bitset_bag_optimize(bag, 1);
+	}
+	r = 0;
+
+e3:
+	while (n--)
+		free(tids[n]);
+	free(buf);
+e2:
+	free(cards);
+e1:
+	return r;
+}
+
 void bitset_free(bitset_t *set)
 {
 	wrapped_bitmap_free(set->bitmap);
@@ -44,6 +636,12 @@ void bitset_free(bitset_t *set)
 
 void bitset_bag_free(bitset_bag_t *b)
 {
-	// we won't free bitsets[] since some of it is already used by itemtree and the others are already freed when creating tree
+	long i;
+	// infrequent items and items taken over by the item tree have no bitmap
+	for (i=0; i<b->len; i++)
+		if (b->bitsets[i].bitmap)
+			bitset_free(b->bitsets+i);
+	free(b->bitsets);
+	free(b->ids);
 	free(b);
-}
\ No newline at end of file
+}
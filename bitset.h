@@ -1,6 +1,8 @@
 #ifndef BITSET_H
 #define BITSET_H
 
+#include <stddef.h>
+
 #include "wrapper.h"
 #include "itemset.h"
 
@@ -14,10 +16,40 @@ typedef struct
 typedef struct
 {
 	int len;
+	int cap;
 	bitset_t *bitsets;
+	long ntran; // transactions the bitsets were built from
+	int *ids; // original id of each item if they were mapped to dense ones, or NULL
 } bitset_bag_t;
 
-bitset_bag_t *bitset_bag_create(itemset_bag_t *ibag);
+// backends an auto tuning compares
+#define BITSET_TUNE_MAX	8
+
+// what a backend measured on the sampled bitsets
+typedef struct
+{
+	const char *backend;
+	double ns; // per intersection
+	size_t bytes; // serialized size of all frequent bitsets, projected from the sample
+} bitset_cost_t;
+
+// the profile of the frequent bitsets and the cost of every backend on a sample of them
+typedef struct
+{
+	int len; // frequent bitsets
+	int nsample;
+	double density; // tids per transaction in the sample
+	double run; // tids per run of consecutive tids in the sample
+	long min, median, max; // cardinalities of the frequent bitsets
+	int ncost;
+	bitset_cost_t costs[BITSET_TUNE_MAX];
+	int best;
+} bitset_tune_t;
+
+bitset_bag_t *bitset_bag_create(itemset_bag_t *ibag, long minsup, int nthreads);
+long bitset_bag_optimize(bitset_bag_t *bag, int nthreads);
+int bitset_bag_tune(bitset_bag_t *bag, long minsup, bitset_tune_t *tune);
+bitset_bag_t *bitset_bag_load(char *path, double frac, double minsupf, int nthreads);
 void bitset_free(bitset_t *set);
 void bitset_bag_free(bitset_bag_t *bag);
 
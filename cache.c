@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include "cache.h"
+
+#define CACHE_MAGIC		"BECACHE1"
+#define CACHE_BACKEND_MAX	16
+
+// followed by a record for each bitset. its cardinality, the length of its serialized
+// bitmap and the bitmap itself, padded to a multiple of 8 bytes. with mapped item ids
+// the original ids of the items come last
+typedef struct
+{
+	char magic[8];
+	char backend[CACHE_BACKEND_MAX];
+	long len;
+	long ntran;
+	long ids;
+	long reserved;
+} cache_header_t;
+
+#define CACHE_PAD(x)	(((x)+7)/8*8)
+
+// bytes of a dataset sampled at its start, middle and end
+#define CACHE_SAMPLE	4096
+
+unsigned long cache_mix(unsigned long h, const unsigned char *p, long n)
+{
+	unsigned long w;
+	long i;
+	for (i=0; i+8<=n; i+=8)
+	{
+		memcpy(&w, p+i, 8);
+		h = (h^w)*0xff51afd7ed558ccdUL;
+		h ^= h>>32;
+	}
+	for (w=0; i<n; i++)
+		w = (w<<8)|p[i];
+	h = (h^w)*0xc4ceb9fe1a85ec53UL;
+	h ^= h>>29;
+	return h;
+}
+
+// key of a dataset file. reading all of it would cost about as much as a hit saves, so it
+// is its path, inode, size and modification time, and samples of its contents against a
+// rewrite that keeps those. returns -1 if it can not be read
+int cache_hash(char *path, unsigned long *hash)
+{
+	int fd, i;
+	struct stat st;
+	char real[PATH_MAX];
+	unsigned char buf[CACHE_SAMPLE];
+	long id[5], off;
+	ssize_t n;
+	unsigned long h;
+	
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto e1;
+	// a stream has no size and can not be read twice, so it has no hash
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		goto e2;
+	if (!realpath(path, real))
+		goto e2;
+	h = cache_mix(0x9e3779b97f4a7c15UL, (unsigned char *)real, strlen(real));
+	id[0] = st.st_dev;
+	id[1] = st.st_ino;
+	id[2] = st.st_size;
+	id[3] = st.st_mtim.tv_sec;
+	id[4] = st.st_mtim.tv_nsec;
+	h = cache_mix(h, (unsigned char *)id, sizeof(id));
+	for (i=0; i<3; i++)
+	{
+		off = i==0? 0: i==1? st.st_size/2: st.st_size-CACHE_SAMPLE;
+		n = pread(fd, buf, CACHE_SAMPLE, off>0? off: 0);
+		if (n < 0)
+			goto e2;
+		h = cache_mix(h, buf, n);
+	}
+	close(fd);
+	*hash = h;
+	return 0;
+
+e2:
+	close(fd);
+e1:
+	return -1;
+}
+
+// the hash of shards combines theirs in order. a single dataset keeps its own
+int cache_path(char *buf, size_t cap, char *dir, char **infiles, int len, double frac)
+{
+	unsigned long hash = 0, h;
+	int i;
+	for (i=0; i<len; i++)
+	{
+		if (cache_hash(infiles[i], &h))
+			return -1;
+		hash = i? (hash*0x9e3779b97f4a7c15UL)^h: h;
+	}
+	if (snprintf(buf, cap, "%s/%016lx-%g-%s.bitsets", dir, hash, frac<1.0? frac: 1.0, wrapped_bitmap_backend()) >= cap)
+		return -1;
+	return 0;
+}
+
+// returns NULL if there is no valid entry at path
+bitset_bag_t *cache_load(char *path)
+{
+	int fd;
+	struct stat st;
+	char *data;
+	long i, pos;
+	cache_header_t *h;
+	bitset_bag_t *bag;
+	
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto e1;
+	if (fstat(fd, &st) || st.st_size < sizeof(cache_header_t))
+		goto e2;
+	data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto e2;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	h = (cache_header_t *)data;
+	if (memcmp(h->magic, CACHE_MAGIC, 8) || strncmp(h->backend, wrapped_bitmap_backend(), CACHE_BACKEND_MAX) || h->len < 0)
+		goto e3;
+	
+	bag = (bitset_bag_t *)calloc(1, sizeof(bitset_bag_t));
+	if (!bag)
+		goto e3;
+	bag->ntran = h->ntran;
+	bag->bitsets = (bitset_t *)malloc((h->len+1)*sizeof(bitset_t));
+	if (!bag->bitsets)
+		goto e4;
+	bag->cap = h->len+1;
+	for (i=0, pos=sizeof(cache_header_t); i<h->len; i++)
+	{
+		long rec[2];
+		if (pos+sizeof(rec) > st.st_size)
+			goto e4;
+		memcpy(rec, data+pos, sizeof(rec));
+		pos += sizeof(rec);
+		if (rec[1]<0 || pos+rec[1] > st.st_size)
+			goto e4;
+		bag->bitsets[i].card = rec[0];
+		bag->bitsets[i].bitmap = wrapped_bitmap_deserialize(data+pos, rec[1]);
+		if (!bag->bitsets[i].bitmap)
+			goto e4;
+		bag->len++;
+		pos += CACHE_PAD(rec[1]);
+	}
+	if (h->ids)
+	{
+		if (pos+h->len*sizeof(int) > st.st_size)
+			goto e4;
+		bag->ids = (int *)malloc((h->len+1)*sizeof(int));
+		if (!bag->ids)
+			goto e4;
+		memcpy(bag->ids, data+pos, h->len*sizeof(int));
+	}
+	munmap(data, st.st_size);
+	close(fd);
+	return bag;
+
+e4:
+	bitset_bag_free(bag);
+e3:
+	munmap(data, st.st_size);
+e2:
+	close(fd);
+e1:
+	return NULL;
+}
+
+// writes to a temporary file first so that readers never see a partial entry
+int cache_save(bitset_bag_t *bag, char *path)
+{
+	long i;
+	int r = -1;
+	FILE *fp;
+	char *buf = NULL, *tmp;
+	size_t cap = 0;
+	cache_header_t h;
+	static const char pad[8];
+	
+	tmp = (char *)malloc(strlen(path)+5);
+	if (!tmp)
+		goto e1;
+	sprintf(tmp, "%s.tmp", path);
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		goto e2;
+	
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CACHE_MAGIC, 8);
+	strncpy(h.backend, wrapped_bitmap_backend(), CACHE_BACKEND_MAX-1);
+	h.len = bag->len;
+	h.ntran = bag->ntran;
+	h.ids = bag->ids!=NULL;
+	if (fwrite(&h, sizeof(h), 1, fp) != 1)
+		goto e3;
+	for (i=0; i<bag->len; i++)
+	{
+		long rec[2];
+		size_t size = wrapped_bitmap_serialize_size(bag->bitsets[i].bitmap);
+		if (size > cap)
+		{
+			free(buf);
+			cap = 2*size;
+			buf = (char *)malloc(cap);
+			if (!buf)
+				goto e3;
+		}
+		rec[0] = bag->bitsets[i].card;
+		rec[1] = wrapped_bitmap_serialize(bag->bitsets[i].bitmap, buf);
+		if (fwrite(rec, sizeof(rec), 1, fp) != 1 || fwrite(buf, 1, rec[1], fp) != rec[1])
+			goto e3;
+		if (fwrite(pad, 1, CACHE_PAD(rec[1])-rec[1], fp) != CACHE_PAD(rec[1])-rec[1])
+			goto e3;
+	}
+	if (bag->ids && fwrite(bag->ids, sizeof(int), bag->len, fp) != bag->len)
+		goto e3;
+	r = 0;
+
+e3:
+	free(buf);
+	if (fclose(fp))
+		r = -1;
+	if (r == 0 && rename(tmp, path))
+		r = -1;
+	if (r)
+		unlink(tmp);
+e2:
+	free(tmp);
+e1:
+	return r;
+}
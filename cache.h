@@ -0,0 +1,15 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "bitset.h"
+
+#define CACHE_PATH_MAX	4096
+
+// an on-disk cache of bitset bags. entries are keyed by the dataset files, the fraction of
+// them that was read and the bitmap backend
+int cache_path(char *buf, size_t cap, char *dir, char **infiles, int len, double frac);
+bitset_bag_t *cache_load(char *path);
+int cache_save(bitset_bag_t *bag, char *path);
+
+#endif
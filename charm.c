@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include "charm.h"
+
+#define CHARM_HASH_INIT	1024
+
+// a member of a class. items are added to the prefix of the class by it. they are shared
+// with the members it spawns in deeper classes and never change
+typedef struct
+{
+	int *items;
+	int len;
+	int removed;
+	bitset_t bitset;
+} charm_member_t;
+
+// a closed itemset found so far, with its items sorted
+typedef struct charm_closed
+{
+	struct charm_closed *next;
+	long sup;
+	int len;
+	int items[];
+} charm_closed_t;
+
+// closed itemsets hashed by support, the cardinality of their tidsets. an itemset can only
+// be subsumed by a closed superset of the same support, so one bucket is all there is to check
+typedef struct
+{
+	itemtree_t *tree;
+	long minsup;
+	sink_t *sink;
+	charm_closed_t **buckets;
+	long nbuckets;
+	long len;
+	int *sorted; // scratch for the itemset being checked
+} charm_ctx_t;
+
+int charm_item_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+// tells if sorted a is a subset of sorted b
+int charm_subset(int *a, int alen, int *b, int blen)
+{
+	int i, j;
+	for (i=0, j=0; i<alen && j<blen; j++)
+		if (a[i] == b[j])
+			i++;
+		else if (a[i] < b[j])
+			return 0;
+	return i == alen;
+}
+
+void charm_rehash(charm_ctx_t *ctx)
+{
+	long i, n = 2*ctx->nbuckets;
+	charm_closed_t *c, *next, **buckets;
+	
+	buckets = (charm_closed_t **)calloc(n, sizeof(charm_closed_t *));
+	if (!buckets)
+		return; // longer chains. still correct
+	for (i=0; i<ctx->nbuckets; i++)
+		for (c=ctx->buckets[i]; c!=NULL; c=next)
+		{
+			next = c->next;
+			c->next = buckets[c->sup%n];
+			buckets[c->sup%n] = c;
+		}
+	free(ctx->buckets);
+	ctx->buckets = buckets;
+	ctx->nbuckets = n;
+}
+
+// adds the itemset unless a closed superset with the same support is already known
+void charm_add(charm_ctx_t *ctx, int *items, int len, long sup)
+{
+	charm_closed_t *c;
+	
+	memcpy(ctx->sorted, items, len*sizeof(int));
+	qsort(ctx->sorted, len, sizeof(int), charm_item_cmp);
+	for (c=ctx->buckets[sup%ctx->nbuckets]; c!=NULL; c=c->next)
+		if (c->sup==sup && c->len>=len && charm_subset(ctx->sorted, len, c->items, c->len))
+			return;
+	
+	c = (charm_closed_t *)malloc(sizeof(charm_closed_t)+len*sizeof(int));
+	if (!c)
+		return;
+	c->sup = sup;
+	c->len = len;
+	memcpy(c->items, ctx->sorted, len*sizeof(int));
+	c->next = ctx->buckets[sup%ctx->nbuckets];
+	ctx->buckets[sup%ctx->nbuckets] = c;
+	if (++ctx->len > 2*ctx->nbuckets)
+		charm_rehash(ctx);
+	sink_emit(ctx->sink, 0, c->items, c->len, sup);
+}
+
+// path holds the items of the prefix of the class, plen of them
+void charm_extend(charm_ctx_t *ctx, int *path, int plen, charm_member_t *m, int n)
+{
+	int i, j, k, xlen;
+	charm_member_t *nc;
+	
+	nc = (charm_member_t *)malloc(n*sizeof(charm_member_t));
+	if (!nc)
+		return;
+	for (i=0; i<n; i++)
+	{
+		if (m[i].removed)
+			continue;
+		memcpy(path+plen, m[i].items, m[i].len*sizeof(int));
+		xlen = plen+m[i].len;
+		
+		// the tidset relation of two members follows from the support of their union alone
+		for (j=i+1, k=0; j<n; j++)
+		{
+			if (m[j].removed)
+				continue;
+			long sup = wrapped_bitmap_and_cardinality(m[i].bitset.bitmap, m[j].bitset.bitmap);
+			if (sup < ctx->minsup)
+				continue;
+			if (sup==m[i].bitset.card || sup==m[j].bitset.card)
+			{
+				// equal tidsets. j is never closed apart from i and goes in every extension of i
+				if (sup==m[i].bitset.card && sup==m[j].bitset.card)
+					m[j].removed = 1;
+				// t(i) in t(j). every extension of i contains j
+				if (sup == m[i].bitset.card)
+				{
+					memcpy(path+xlen, m[j].items, m[j].len*sizeof(int));
+					xlen += m[j].len;
+					continue;
+				}
+				// t(j) in t(i). j is only closed together with i
+				m[j].removed = 1;
+			}
+			nc[k].items = m[j].items;
+			nc[k].len = m[j].len;
+			nc[k].removed = 0;
+			nc[k].bitset.bitmap = wrapped_bitmap_and(m[i].bitset.bitmap, m[j].bitset.bitmap);
+			nc[k].bitset.card = sup;
+			k++;
+		}
+		
+		if (k > 0)
+			charm_extend(ctx, path, xlen, nc, k);
+		for (j=0; j<k; j++)
+			wrapped_bitmap_free(nc[j].bitset.bitmap);
+		charm_add(ctx, path, xlen, m[i].bitset.card);
+	}
+	free(nc);
+}
+
+void charm(itemtree_t *tree, long minsup, sink_t *sink)
+{
+	int i, n;
+	itemnode_t *node;
+	charm_ctx_t ctx;
+	charm_member_t *m;
+	charm_closed_t *c, *next;
+	int *items, *path;
+	
+	for (n=0, node=tree->root; node!=NULL; node=node->right)
+		n++;
+	if (n == 0)
+		return;
+	ctx.tree = tree;
+	ctx.minsup = minsup;
+	ctx.sink = sink;
+	ctx.len = 0;
+	ctx.nbuckets = CHARM_HASH_INIT;
+	ctx.buckets = (charm_closed_t **)calloc(ctx.nbuckets, sizeof(charm_closed_t *));
+	m = (charm_member_t *)malloc(n*sizeof(charm_member_t));
+	items = (int *)malloc(n*sizeof(int));
+	// no itemset has more items than the first level
+	path = (int *)malloc(n*sizeof(int));
+	ctx.sorted = (int *)malloc(n*sizeof(int));
+	if (!ctx.buckets || !m || !items || !path || !ctx.sorted)
+		goto e1;
+	
+	for (i=0, node=tree->root; node!=NULL; i++, node=node->right)
+	{
+		items[i] = itemtree_item_id(tree, node->item);
+		m[i].items = items+i;
+		m[i].len = 1;
+		m[i].removed = 0;
+		m[i].bitset = *node->bitset;
+	}
+	charm_extend(&ctx, path, 0, m, n);
+	
+	for (i=0; i<ctx.nbuckets; i++)
+		for (c=ctx.buckets[i]; c!=NULL; c=next)
+		{
+			next = c->next;
+			free(c);
+		}
+e1:
+	free(ctx.buckets);
+	free(m);
+	free(items);
+	free(path);
+	free(ctx.sorted);
+}
@@ -0,0 +1,11 @@
+#ifndef CHARM_H
+#define CHARM_H
+
+#include "itemtree.h"
+#include "sink.h"
+
+// mines closed frequent itemsets (CHARM) starting from the first level of the tree.
+// each closed itemset is emitted to the sink once it is known to be closed
+void charm(itemtree_t *tree, long minsup, sink_t *sink);
+
+#endif
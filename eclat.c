@@ -1,37 +1,440 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "eclat.h"
+#include "pool.h"
 
-void eclat_rec(itemnode_t *prefix_end, itemnode_t *item_start, long minsup)
+// classes this close to the top always become separate tasks. deeper ones only when a worker is idle
+#define ECLAT_SPLIT_DEPTH	2
+
+// state shared by all tasks of one mining run
+typedef struct
+{
+	itemtree_t *tree;
+	long minsup;
+	int mode;
+	int flags;
+	sink_t *sink;
+	int pathcap; // longest possible itemset
+	pool_t *pool;
+} eclat_ctx_t;
+
+// members of a class. any of them may be read by the extension of any member to its left,
+// so with more than one thread their bitmaps only go once all extensions are built. when
+// streaming, the members themselves are allocated right after this header and go with it
+typedef struct
+{
+	itemnode_t *start;
+	long pending;
+} declat_class_t;
+
+typedef struct
+{
+	itemnode_t node;
+	bitset_t bitset;
+} declat_slot_t;
+
+typedef struct
+{
+	eclat_ctx_t *ctx;
+	itemnode_t *prefix_end;
+	itemnode_t *item_start;
+	declat_class_t *cls;
+	int depth;
+	int diff;
+	int *path; // items mined so far when streaming. the task owns a copy
+	itemnode_t node; // prefix_end when streaming, since its creator does not keep it
+	bitset_t bitset;
+} eclat_task_t;
+
+// a task only inserts below the nodes it has created itself, and never changes the right
+// links of nodes other tasks read from. so subtrees are attached with itemtree_insert_down
+// without any locking
+eclat_task_t *eclat_task_create(eclat_ctx_t *ctx, int depth, int *path, int len)
+{
+	eclat_task_t *t;
+
+	if (!ctx->pool || (depth>=ECLAT_SPLIT_DEPTH && !pool_idle(ctx->pool)))
+		return NULL;
+	t = (eclat_task_t *)malloc(sizeof(eclat_task_t));
+	if (!t)
+		return NULL;
+	t->ctx = ctx;
+	t->path = NULL;
+	if (ctx->sink)
+	{
+		t->path = (int *)malloc(ctx->pathcap*sizeof(int));
+		if (!t->path)
+		{
+			free(t);
+			return NULL;
+		}
+		memcpy(t->path, path, len*sizeof(int));
+	}
+	return t;
+}
+
+void eclat_task_free(eclat_task_t *t)
+{
+	free(t->path);
+	free(t);
+}
+
+// an itemset left out would go unnoticed, so mining does not go on without it
+void eclat_fail(void)
+{
+	fprintf(stderr, "out of memory while mining\n");
+	exit(1);
+}
+
+void eclat_bitmap_free(itemnode_t *node)
+{
+	if (!node->bitset->bitmap)
+		return;
+	wrapped_bitmap_free(node->bitset->bitmap);
+	node->bitset->bitmap = NULL;
+}
+
+// emits the first level itemsets and returns a buffer for the items of longer ones
+int *eclat_stream_start(eclat_ctx_t *ctx)
 {
 	itemnode_t *node;
+	int *path;
+	
+	for (ctx->pathcap=1, node=ctx->tree->root; node!=NULL; node=node->right)
+		ctx->pathcap++;
+	path = (int *)malloc(ctx->pathcap*sizeof(int));
+	if (!path)
+		return NULL;
+	for (node=ctx->tree->root; node!=NULL; node=node->right)
+	{
+		path[0] = itemtree_item_id(ctx->tree, node->item);
+		sink_emit(ctx->sink, 0, path, 1, node->bitset->card);
+	}
+	return path;
+}
+
+void eclat_task(void *arg, int worker);
+
+// worker is the index of the thread running this, and so of its node arena. when
+// streaming, path holds the items of prefix_end and nodes are kept only while mined
+void eclat_rec(eclat_ctx_t *ctx, int worker, itemnode_t *prefix_end, itemnode_t *item_start, int depth, int *path)
+{
+	itemnode_t *node, *n, sn;
+	bitset_t sb;
+	eclat_task_t *t;
 	
 	for (node=item_start; node!=NULL; node=node->right)
 	{
-		wrapped_bitmap_t *r = wrapped_bitmap_and(prefix_end->bitset->bitmap, node->bitset->bitmap);
-		long freq = wrapped_bitmap_get_cardinality(r);
-		if (freq < minsup)
-		{
-			wrapped_bitmap_free(r);
+		// count first. most candidates are infrequent and never need their intersection built
+		long freq = wrapped_bitmap_and_cardinality(prefix_end->bitset->bitmap, node->bitset->bitmap);
+		if (freq < ctx->minsup)
 			continue;
+		if (ctx->sink)
+		{
+			path[depth+1] = itemtree_item_id(ctx->tree, node->item);
+			sink_emit(ctx->sink, worker, path, depth+2, freq);
+			if (!node->right)
+				continue;
 		}
+		wrapped_bitmap_t *r = wrapped_bitmap_and(prefix_end->bitset->bitmap, node->bitset->bitmap);
+		if (!r)
+			eclat_fail();
 		
-		itemnode_t *n = (itemnode_t *)malloc(sizeof(itemnode_t));
-		n->item = node->item;
-		n->bitset = (bitset_t *)malloc(sizeof(bitset_t));
-		n->bitset->bitmap = r;
-		n->bitset->card = freq; // need this?
-		//n->count = freq;
-		n->down = NULL;
-		itemtree_insert_down(prefix_end, n);
+		if (ctx->sink)
+		{
+			sb.bitmap = r;
+			sb.card = freq;
+			sn.item = node->item;
+			sn.bitset = &sb;
+			sn.down = NULL;
+			sn.up = NULL;
+			n = &sn;
+		}
+		else
+		{
+			n = itemtree_node_create(ctx->tree, worker, node->item, r, freq);
+			if (!n)
+				eclat_fail();
+			itemtree_insert_down(prefix_end, n);
+		}
 		
-		eclat_rec(n, node->right, minsup);
+		if (node->right && (t=eclat_task_create(ctx, depth+1, path, depth+2)))
+		{
+			t->prefix_end = n;
+			if (ctx->sink)
+			{
+				t->node = sn;
+				t->bitset = sb;
+				t->node.bitset = &t->bitset;
+				t->prefix_end = &t->node;
+			}
+			t->item_start = node->right;
+			t->depth = depth+1;
+			pool_submit(ctx->pool, eclat_task, t);
+		}
+		else
+			eclat_rec(ctx, worker, n, node->right, depth+1, path);
+	}
+	// first level bitmaps are the tails of other classes. deeper ones are only read here
+	if ((ctx->flags & ECLAT_LOWMEM) && depth>0)
+		eclat_bitmap_free(prefix_end);
+}
+
+void eclat_task(void *arg, int worker)
+{
+	eclat_task_t *t = (eclat_task_t *)arg;
+	eclat_rec(t->ctx, worker, t->prefix_end, t->item_start, t->depth, t->path);
+	eclat_task_free(t);
+}
+
+void eclat(itemtree_t *tree, long minsup, int flags, sink_t *sink, int nthreads)
+{
+	itemnode_t *node;
+	eclat_ctx_t ctx;
+	int *path = NULL;
+	
+	ctx.tree = tree;
+	ctx.minsup = minsup;
+	ctx.mode = 0;
+	// a streamed itemset is never read again
+	ctx.flags = sink? flags|ECLAT_LOWMEM: flags;
+	ctx.sink = sink;
+	if (sink && !(path=eclat_stream_start(&ctx)))
+		return;
+	ctx.pool = nthreads>1? pool_create(nthreads): NULL;
+	for (node=tree->root; node!=NULL; node=node->right)
+	{
+		if (path)
+			path[0] = itemtree_item_id(tree, node->item);
+		eclat_task_t *t = eclat_task_create(&ctx, 0, path, 1);
+		if (t)
+		{
+			t->prefix_end = node;
+			t->item_start = node->right;
+			t->depth = 0;
+			pool_submit(ctx.pool, eclat_task, t);
+		}
+		else
+		{
+			eclat_rec(&ctx, 0, node, node->right, 0, path);
+			// classes to the left, the only ones with this item in their tail, are done
+			if (ctx.flags & ECLAT_LOWMEM)
+				eclat_bitmap_free(node);
+		}
+	}
+	if (ctx.pool)
+	{
+		pool_run(ctx.pool);
+		pool_free(ctx.pool);
 	}
+	free(path);
+}
+
+// support of the candidate a+b within a class. diff tells if the class holds diffsets
+// relative to its prefix rather than tidsets. bitset->card is always the support
+long declat_support(itemnode_t *a, itemnode_t *b, int diff)
+{
+	if (diff)
+		return a->bitset->card - wrapped_bitmap_andnot_cardinality(b->bitset->bitmap, a->bitset->bitmap);
+	return wrapped_bitmap_and_cardinality(a->bitset->bitmap, b->bitset->bitmap);
+}
+
+// d(PXY) = t(PX) \ t(PY) when switching from tidsets, d(PY) \ d(PX) when already on diffsets
+wrapped_bitmap_t *declat_build(itemnode_t *a, itemnode_t *b, int diff, int cdiff)
+{
+	if (diff)
+		return wrapped_bitmap_andnot(b->bitset->bitmap, a->bitset->bitmap);
+	if (cdiff)
+		return wrapped_bitmap_andnot(a->bitset->bitmap, b->bitset->bitmap);
+	return wrapped_bitmap_and(a->bitset->bitmap, b->bitset->bitmap);
 }
 
-void eclat(itemnode_t *root, long minsup)
+void declat_rec(eclat_ctx_t *ctx, int worker, itemnode_t *class_start, declat_class_t *cls, int diff, int depth, int *path);
+void declat_task(void *arg, int worker);
+
+void declat_class_release(declat_class_t *cls)
 {
 	itemnode_t *node;
+	if (__atomic_sub_fetch(&cls->pending, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (node=cls->start; node!=NULL; node=node->right)
+		eclat_bitmap_free(node);
+	free(cls);
+}
+
+// a class of n members to be streamed. they are linked but left empty
+declat_class_t *declat_class_create(long n)
+{
+	long i;
+	declat_class_t *cls = (declat_class_t *)malloc(sizeof(declat_class_t)+n*sizeof(declat_slot_t));
+	if (!cls)
+		return NULL;
+	declat_slot_t *slots = (declat_slot_t *)(cls+1);
+	for (i=0; i<n; i++)
+	{
+		slots[i].node.bitset = &slots[i].bitset;
+		slots[i].node.right = i<n-1? &slots[i+1].node: NULL;
+		slots[i].node.down = NULL;
+		slots[i].node.up = NULL;
+	}
+	cls->start = &slots[0].node;
+	return cls;
+}
+
+// builds the class of a from its right siblings and mines it. cls is the class of a when its
+// bitmaps are freed by the last extension. path holds the items of a's prefix when streaming
+void declat_extend(eclat_ctx_t *ctx, int worker, itemnode_t *a, int diff, int depth, declat_class_t *cls, int *path)
+{
+	itemnode_t *b, *c, *start;
+	declat_class_t *ncls = NULL;
+	long i, n, k, *sup;
+	
+	for (n=0, b=a->right; b!=NULL; b=b->right)
+		n++;
+	sup = (long *)malloc(n*sizeof(long));
+	if (!sup && n)
+		eclat_fail();
+	
+	// supports of the whole new class are counted before building it, so that
+	// its representation can be chosen from the total tidset and diffset sizes
+	long tsize = 0, dsize = 0;
+	for (i=0, k=0, b=a->right; b!=NULL; i++, b=b->right)
+	{
+		sup[i] = declat_support(a, b, diff);
+		if (sup[i] >= ctx->minsup)
+		{
+			tsize += sup[i];
+			dsize += a->bitset->card - sup[i];
+			k++;
+		}
+	}
+	// once on diffsets there is no way back, since tidsets of the prefix are gone
+	int cdiff = diff || ctx->mode==DECLAT_DIFFSET || (ctx->mode==DECLAT_AUTO && dsize<tsize);
+	
+	if (ctx->sink)
+	{
+		path[depth] = itemtree_item_id(ctx->tree, a->item);
+		for (i=0, b=a->right; b!=NULL; i++, b=b->right)
+			if (sup[i] >= ctx->minsup)
+			{
+				path[depth+1] = itemtree_item_id(ctx->tree, b->item);
+				sink_emit(ctx->sink, worker, path, depth+2, sup[i]);
+			}
+		// a single itemset is not combined with anything. no need for its bitmap
+		if (k <= 1)
+			k = 0;
+		else if ((ncls=declat_class_create(k)))
+			a->down = ncls->start;
+		else
+			eclat_fail();
+	}
+	
+	for (i=0, b=a->right, c=a->down; b!=NULL && k>0; i++, b=b->right)
+	{
+		if (sup[i] < ctx->minsup)
+			continue;
+		wrapped_bitmap_t *r = declat_build(a, b, diff, cdiff);
+		if (!r)
+			eclat_fail();
+		if (ctx->sink)
+		{
+			c->item = b->item;
+			c->bitset->bitmap = r;
+			c->bitset->card = sup[i];
+			c = c->right;
+		}
+		else
+		{
+			itemnode_t *n = itemtree_node_create(ctx->tree, worker, b->item, r, sup[i]);
+			if (!n)
+				eclat_fail();
+			itemtree_insert_down(a, n);
+		}
+	}
+	free(sup);
+	if (ctx->flags & ECLAT_REORDER)
+		itemtree_sort_down(a);
+	start = a->down;
+	if (ncls)
+	{
+		// streamed classes are not part of the tree
+		ncls->start = start;
+		a->down = NULL;
+	}
+	
+	// the new class is all that is needed from here on. mined one by one, members to the left
+	// are done with a by now. otherwise the last extension of the class frees them all
+	if ((ctx->flags & ECLAT_LOWMEM) && !ctx->pool)
+		eclat_bitmap_free(a);
+	if (cls)
+		declat_class_release(cls);
+	
+	declat_rec(ctx, worker, start, ncls, cdiff, depth+1, path);
+}
+
+// cls is set for streamed classes, which are freed once mined
+void declat_rec(eclat_ctx_t *ctx, int worker, itemnode_t *class_start, declat_class_t *cls, int diff, int depth, int *path)
+{
+	itemnode_t *a;
+	eclat_task_t *t;
 	
-	for (node=root; node!=NULL; node=node->right)
-		eclat_rec(node, node->right, minsup);
+	if (!class_start)
+		return;
+	if (!cls && (ctx->flags & ECLAT_LOWMEM) && ctx->pool && class_start->right)
+		if ((cls=(declat_class_t *)malloc(sizeof(declat_class_t))))
+			cls->start = class_start;
+	// this loop holds the class as well, until it is done walking it
+	if (cls)
+		for (cls->pending=1, a=class_start; a->right!=NULL; a=a->right)
+			cls->pending++;
+	
+	// the last member of a class has nothing to its right to combine with
+	for (a=class_start; a->right!=NULL; a=a->right)
+	{
+		if ((t=eclat_task_create(ctx, depth, path, depth)))
+		{
+			t->prefix_end = a;
+			t->cls = cls;
+			t->diff = diff;
+			t->depth = depth;
+			pool_submit(ctx->pool, declat_task, t);
+		}
+		else
+			declat_extend(ctx, worker, a, diff, depth, cls, path);
+	}
+	// the last member is only read by the others. a member alone in its class by no one
+	if ((ctx->flags & ECLAT_LOWMEM) && (!ctx->pool || a==class_start))
+		eclat_bitmap_free(a);
+	if (cls)
+		declat_class_release(cls);
+}
+
+void declat_task(void *arg, int worker)
+{
+	eclat_task_t *t = (eclat_task_t *)arg;
+	declat_extend(t->ctx, worker, t->prefix_end, t->diff, t->depth, t->cls, t->path);
+	eclat_task_free(t);
+}
+
+void declat(itemtree_t *tree, long minsup, int mode, int flags, sink_t *sink, int nthreads)
+{
+	eclat_ctx_t ctx;
+	int *path = NULL;
+	
+	ctx.tree = tree;
+	ctx.minsup = minsup;
+	ctx.mode = mode;
+	ctx.flags = sink? flags|ECLAT_LOWMEM: flags;
+	ctx.sink = sink;
+	if (sink && !(path=eclat_stream_start(&ctx)))
+		return;
+	ctx.pool = nthreads>1? pool_create(nthreads): NULL;
+	declat_rec(&ctx, 0, tree->root, NULL, 0, 0, path);
+	if (ctx.pool)
+	{
+		pool_run(ctx.pool);
+		pool_free(ctx.pool);
+	}
+	free(path);
 }
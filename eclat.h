@@ -2,8 +2,20 @@
 #define ECLAT_H
 
 #include "itemtree.h"
+#include "sink.h"
 
-void eclat(itemnode_t *root, long minsup);
+// tidset/diffset modes of declat
+#define DECLAT_TIDSET	0	// tidsets only. class based eclat
+#define DECLAT_DIFFSET	1	// diffsets from the second level on
+#define DECLAT_AUTO		2	// tidsets until diffsets of a class get smaller
 
-#endif
+// mining flags
+#define ECLAT_REORDER	1	// sort the members of every new class by ascending support. declat only
+#define ECLAT_LOWMEM	2	// free bitmaps as soon as no candidate needs them. supports are kept
+
+// nthreads>1 mines the classes on a work-stealing pool. the tree needs an arena per thread.
+// with a sink, itemsets are emitted as they are found and only the first level stays in the tree
+void eclat(itemtree_t *tree, long minsup, int flags, sink_t *sink, int nthreads);
+void declat(itemtree_t *tree, long minsup, int mode, int flags, sink_t *sink, int nthreads);
 
+#endif
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include "genmax.h"
+
+#define GENMAX_LIST_INIT	16
+
+// a candidate extension of the current head. the tidset is of head plus item
+typedef struct
+{
+	int item;
+	bitset_t bitset;
+} genmax_member_t;
+
+// a maximal itemset found so far, with its items sorted
+typedef struct genmax_set
+{
+	struct genmax_set *next;
+	int len;
+	int items[];
+} genmax_set_t;
+
+typedef struct
+{
+	genmax_set_t **sets;
+	long len;
+	long cap;
+} genmax_list_t;
+
+typedef struct
+{
+	itemtree_t *tree;
+	long minsup;
+	sink_t *sink;
+	genmax_set_t *all;
+	// lmfi[l] holds the maximal itemsets that contain the first l items of the head.
+	// only those can subsume anything below it. this is progressive focusing
+	genmax_list_t *lmfi;
+	int *head;
+	int *scratch;
+	int *ids;
+} genmax_ctx_t;
+
+int genmax_item_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+int genmax_member_cmp(const void *a, const void *b)
+{
+	const genmax_member_t *x = (const genmax_member_t *)a, *y = (const genmax_member_t *)b;
+	if (x->bitset.card != y->bitset.card)
+		return x->bitset.card<y->bitset.card? -1: 1;
+	return x->item - y->item;
+}
+
+int genmax_contains(genmax_set_t *set, int item)
+{
+	int lo = 0, hi = set->len;
+	while (lo < hi)
+	{
+		int mid = (lo+hi)/2;
+		if (set->items[mid] < item)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo<set->len && set->items[lo]==item;
+}
+
+// tells if some set of the list contains all items of the members. the list already
+// contains the head, so the members are all there is to check
+int genmax_subsumed(genmax_ctx_t *ctx, genmax_list_t *list, genmax_member_t *m, int n)
+{
+	long i;
+	int j, k;
+	
+	if (list->len == 0)
+		return 0;
+	for (j=0; j<n; j++)
+		ctx->scratch[j] = m[j].item;
+	qsort(ctx->scratch, n, sizeof(int), genmax_item_cmp);
+	for (i=0; i<list->len; i++)
+	{
+		genmax_set_t *s = list->sets[i];
+		for (j=0, k=0; j<n && k<s->len; k++)
+			if (s->items[k] == ctx->scratch[j])
+				j++;
+			else if (s->items[k] > ctx->scratch[j])
+				break;
+		if (j == n)
+			return 1;
+	}
+	return 0;
+}
+
+int genmax_list_add(genmax_list_t *list, genmax_set_t *set)
+{
+	if (list->len == list->cap)
+	{
+		long cap = list->cap? 2*list->cap: GENMAX_LIST_INIT;
+		genmax_set_t **sets = (genmax_set_t **)realloc(list->sets, cap*sizeof(genmax_set_t *));
+		if (!sets)
+			return -1;
+		list->sets = sets;
+		list->cap = cap;
+	}
+	list->sets[list->len++] = set;
+	return 0;
+}
+
+// records head plus the members as maximal. it contains the heads of all levels down to this
+void genmax_found(genmax_ctx_t *ctx, int level, genmax_member_t *m, int n, long sup)
+{
+	int i, len = level+n;
+	genmax_set_t *set = (genmax_set_t *)malloc(sizeof(genmax_set_t)+len*sizeof(int));
+	if (!set)
+		return;
+	memcpy(set->items, ctx->head, level*sizeof(int));
+	for (i=0; i<n; i++)
+		set->items[level+i] = m[i].item;
+	set->len = len;
+	qsort(set->items, len, sizeof(int), genmax_item_cmp);
+	set->next = ctx->all;
+	ctx->all = set;
+	for (i=0; i<=level; i++)
+		genmax_list_add(ctx->lmfi+i, set);
+	
+	for (i=0; i<len; i++)
+		ctx->ids[i] = itemtree_item_id(ctx->tree, set->items[i]);
+	sink_emit(ctx->sink, 0, ctx->ids, len, sup);
+}
+
+// support of head plus all of c if it is frequent. 0 otherwise
+long genmax_hut(genmax_ctx_t *ctx, genmax_member_t *c, int n)
+{
+	int i;
+	long sup = c[0].bitset.card;
+	wrapped_bitmap_t *r = NULL, *next;
+	
+	for (i=1; i<n && sup>=ctx->minsup; i++)
+	{
+		wrapped_bitmap_t *prev = r? r: c[0].bitset.bitmap;
+		sup = wrapped_bitmap_and_cardinality(prev, c[i].bitset.bitmap);
+		if (sup<ctx->minsup || i==n-1)
+			break;
+		next = wrapped_bitmap_and(prev, c[i].bitset.bitmap);
+		if (r)
+			wrapped_bitmap_free(r);
+		r = next;
+	}
+	if (r)
+		wrapped_bitmap_free(r);
+	return sup>=ctx->minsup? sup: 0;
+}
+
+// the head holds level items. m are its frequent extensions, in ascending support
+void genmax_rec(genmax_ctx_t *ctx, genmax_member_t *m, int n, int level)
+{
+	int i, j, k;
+	long l;
+	genmax_member_t *c;
+	genmax_list_t *lmfi = ctx->lmfi+level, *next = ctx->lmfi+level+1;
+	
+	c = (genmax_member_t *)malloc(n*sizeof(genmax_member_t));
+	if (!c)
+		return;
+	for (i=0; i<n; i++)
+	{
+		ctx->head[level] = m[i].item;
+		for (l=0, next->len=0; l<lmfi->len; l++)
+			if (genmax_contains(lmfi->sets[l], m[i].item))
+				genmax_list_add(next, lmfi->sets[l]);
+		// head plus everything to the right is in a known maximal itemset, and so is anything
+		// this or later members could still find
+		if (i<n-1 && genmax_subsumed(ctx, next, m+i+1, n-i-1))
+			break;
+		
+		for (j=i+1, k=0; j<n; j++)
+		{
+			long sup = wrapped_bitmap_and_cardinality(m[i].bitset.bitmap, m[j].bitset.bitmap);
+			if (sup < ctx->minsup)
+				continue;
+			c[k].item = m[j].item;
+			c[k].bitset.bitmap = wrapped_bitmap_and(m[i].bitset.bitmap, m[j].bitset.bitmap);
+			c[k].bitset.card = sup;
+			k++;
+		}
+		
+		if (k == 0)
+		{
+			// every set of next contains the head
+			if (next->len == 0)
+				genmax_found(ctx, level+1, NULL, 0, m[i].bitset.card);
+			continue;
+		}
+		qsort(c, k, sizeof(genmax_member_t), genmax_member_cmp);
+		long sup = genmax_hut(ctx, c, k);
+		if (sup)
+		{
+			// head union tail is frequent. it is the only maximal itemset this subtree can have
+			if (!genmax_subsumed(ctx, next, c, k))
+				genmax_found(ctx, level+1, c, k, sup);
+		}
+		else
+			genmax_rec(ctx, c, k, level+1);
+		for (j=0; j<k; j++)
+			wrapped_bitmap_free(c[j].bitset.bitmap);
+	}
+	free(c);
+}
+
+void genmax(itemtree_t *tree, long minsup, sink_t *sink)
+{
+	int i, n;
+	itemnode_t *node;
+	genmax_ctx_t ctx;
+	genmax_member_t *m;
+	genmax_set_t *set, *next;
+	
+	for (n=0, node=tree->root; node!=NULL; node=node->right)
+		n++;
+	if (n == 0)
+		return;
+	ctx.tree = tree;
+	ctx.minsup = minsup;
+	ctx.sink = sink;
+	ctx.all = NULL;
+	ctx.lmfi = (genmax_list_t *)calloc(n+2, sizeof(genmax_list_t));
+	ctx.head = (int *)malloc(n*sizeof(int));
+	ctx.scratch = (int *)malloc(n*sizeof(int));
+	ctx.ids = (int *)malloc(n*sizeof(int));
+	m = (genmax_member_t *)malloc(n*sizeof(genmax_member_t));
+	if (!ctx.lmfi || !ctx.head || !ctx.scratch || !ctx.ids || !m)
+		goto e1;
+	
+	for (i=0, node=tree->root; node!=NULL; i++, node=node->right)
+	{
+		m[i].item = node->item;
+		m[i].bitset = *node->bitset;
+	}
+	// extensions of low support first. they end early and leave big maximal itemsets to prune with
+	qsort(m, n, sizeof(genmax_member_t), genmax_member_cmp);
+	genmax_rec(&ctx, m, n, 0);
+	
+	for (set=ctx.all; set!=NULL; set=next)
+	{
+		next = set->next;
+		free(set);
+	}
+	for (i=0; i<n+2; i++)
+		free(ctx.lmfi[i].sets);
+e1:
+	free(ctx.lmfi);
+	free(ctx.head);
+	free(ctx.scratch);
+	free(ctx.ids);
+	free(m);
+}
@@ -0,0 +1,11 @@
+#ifndef GENMAX_H
+#define GENMAX_H
+
+#include "itemtree.h"
+#include "sink.h"
+
+// mines maximal frequent itemsets (GenMax with MAFIA's head union tail lookahead) starting
+// from the first level of the tree. each maximal itemset is emitted to the sink once found
+void genmax(itemtree_t *tree, long minsup, sink_t *sink);
+
+#endif
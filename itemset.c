@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "itemset.h"
+#include "pool.h"
 
 
 #define IS_NEWLINE(c)	((c)=='\n' || (c)=='\r')
@@ -9,144 +21,1385 @@
 #define IS_NUM(c)		((c)>='0' && (c)<='9')
 #define IS_VALID(c)		(IS_NEWLINE(c) || IS_SEP(c) || IS_NUM(c))
 
-itemset_bag_t *itemset_bag_create(char *path, double frac)
+// chunks per thread. more than one evens out chunks of different density
+#define ITEMSET_CHUNKS	4
+// bytes of input a scan parses at once and keeps mapped behind its position
+#define ITEMSET_SCAN_WINDOW	(64L<<20)
+// item ids are sparse when they outnumber the items this many times. they are mapped
+// to dense ones then
+#define ITEMSET_SPARSE	4
+#define ITEMSET_DICT_INIT	1024
+// ids below this are counted in place in the first pass, the others in a dictionary
+#define ITEMSET_LOW	(1<<16)
+// bytes of a stream read before they are parsed
+#define ITEMSET_SEGMENT	(64L<<20)
+// segments a stream reads ahead of the parser
+#define ITEMSET_QUEUE	2
+
+// classes of a block of input as masks, bit i for byte i
+typedef struct
+{
+	uint64_t num;
+	uint64_t sep;
+	uint64_t nl;
+} itemset_mask_t;
+
+typedef itemset_mask_t (*itemset_classify_t)(const char *p);
+
+// supports a worker counts in the first pass
+typedef struct
+{
+	long *low; // of the ids below ITEMSET_LOW
+	itemset_dict_t dict; // of the others
+} itemset_counts_t;
+
+// a part of the input that starts and ends at line boundaries
+typedef struct
 {
-	long i, j;
-	FILE *fp;
-	char *buf;
 	itemset_bag_t *bag;
+	itemset_classify_t classify;
+	const char *data;
+	long base; // offset of data in the input
+	const char *path; // of the shard the chunk is part of, or NULL for a single input
+	const char *start;
+	const char *end;
+	long ntran; // transactions, counted in the first pass
+	long nitem; // items, counted in the first pass
+	long tran; // first transaction, for the second pass
+	long item; // first item, for the second pass
+	itemset_counts_t *counts; // supports counted by every worker in the first pass
+	itemset_dict_t *map; // maps the ids of the second pass, or NULL if they are kept
+	int nomem; // supports could not be counted
+	long error; // offset of an invalid character or -1
+} itemset_chunk_t;
+
+// a part of a stream that ends at a line boundary
+typedef struct itemset_segment
+{
+	char *data;
+	long size;
+	long base; // offset of data in the input
+	struct itemset_segment *next;
+} itemset_segment_t;
+
+typedef struct
+{
+	int fd;
+	int wake[2]; // pipe that wakes the reader from waiting for input when it is stopped
+	itemset_segment_t *head; // segments read and not yet taken
+	itemset_segment_t **tail;
+	int queued;
+	int done; // 1 at the end of the input, -1 on a read error
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} itemset_reader_t;
+
+// block tokenizer. classifies ITEMSET_BLOCK bytes at a time into masks of digits, separators
+// and newlines, bit i for byte i, and finds the lines and numbers from the masks. the
+// instruction set is chosen at runtime
+#define ITEMSET_BLOCK	64
+
+// numbers are decoded from ITEMSET_WORD bytes at once, which may run past the block
+#define ITEMSET_WORD	8
+
+// a block of p that can be read ITEMSET_WORD bytes past its end. near the end of a chunk
+// it is copied with the bytes past the end read as newlines
+const char *itemset_block(const char *p, const char *end, char *buf)
+{
+	long n = end-p;
+	if (n >= ITEMSET_BLOCK+ITEMSET_WORD)
+		return p;
+	memset(buf, '\n', ITEMSET_BLOCK+ITEMSET_WORD);
+	memcpy(buf, p, n);
+	return buf;
+}
+
+itemset_mask_t itemset_classify_scalar(const char *p)
+{
+	int i;
+	itemset_mask_t m = {0, 0, 0};
+	for (i=0; i<ITEMSET_BLOCK; i++)
+	{
+		m.num |= (uint64_t)IS_NUM(p[i])<<i;
+		m.sep |= (uint64_t)IS_SEP(p[i])<<i;
+		m.nl |= (uint64_t)IS_NEWLINE(p[i])<<i;
+	}
+	return m;
+}
+
+#if defined(__x86_64__)
+// digits are the bytes above '0'-1 and below '9'+1. bytes from 0x80 compare as negative
+itemset_mask_t itemset_classify_sse2(const char *p)
+{
+	int i;
+	itemset_mask_t m = {0, 0, 0};
+	for (i=0; i<ITEMSET_BLOCK; i+=16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *)(p+i));
+		__m128i num = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9'+1)));
+		__m128i sep = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8(','))), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t')));
+		__m128i nl = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\r')));
+		m.num |= (uint64_t)(uint16_t)_mm_movemask_epi8(num)<<i;
+		m.sep |= (uint64_t)(uint16_t)_mm_movemask_epi8(sep)<<i;
+		m.nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(nl)<<i;
+	}
+	return m;
+}
+
+__attribute__((target("avx2")))
+itemset_mask_t itemset_classify_avx2(const char *p)
+{
+	int i;
+	itemset_mask_t m = {0, 0, 0};
+	for (i=0; i<ITEMSET_BLOCK; i+=32)
+	{
+		__m256i c = _mm256_loadu_si256((const __m256i *)(p+i));
+		__m256i num = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), c));
+		__m256i sep = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(','))), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t')));
+		__m256i nl = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')));
+		m.num |= (uint64_t)(uint32_t)_mm256_movemask_epi8(num)<<i;
+		m.sep |= (uint64_t)(uint32_t)_mm256_movemask_epi8(sep)<<i;
+		m.nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(nl)<<i;
+	}
+	return m;
+}
+#endif
+
+itemset_classify_t itemset_classify_select()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2"))
+		return itemset_classify_avx2;
+	return itemset_classify_sse2;
+#else
+	return itemset_classify_scalar;
+#endif
+}
+
+// value of the number at q. digits is the digit mask from q on, with n valid bits. numbers
+// of up to ITEMSET_WORD digits that end in the block are converted at once, the digits
+// shifted up so that zeros pad them in front. the rest are read byte by byte from p
+int itemset_decode(const char *q, const char *p, const char *end, uint64_t digits, int n)
+{
+	uint64_t x;
+	int len = __builtin_ctzll(~digits);
+	if (len<n && len<=ITEMSET_WORD)
+	{
+		memcpy(&x, q, sizeof(x));
+		x = (x&0x0f0f0f0f0f0f0f0fULL) << (ITEMSET_WORD-len)*8;
+		x = (x*10 + (x>>8)) & 0x00ff00ff00ff00ffULL;
+		x = (x*100 + (x>>16)) & 0x0000ffff0000ffffULL;
+		x = (x*10000 + (x>>32)) & 0xffffffffULL;
+		return (int)x;
+	}
+	x = 0;
+	while (p<end && IS_NUM(*p))
+		x = x*10+(*p++-'0');
+	return (int)x;
+}
+
+int itemset_dict_init(itemset_dict_t *d)
+{
+	memset(d, 0, sizeof(itemset_dict_t));
+	d->slots = (itemset_slot_t *)malloc(ITEMSET_DICT_INIT*sizeof(itemset_slot_t));
+	if (!d->slots)
+		return -1;
+	memset(d->slots, 0xff, ITEMSET_DICT_INIT*sizeof(itemset_slot_t));
+	d->cap = ITEMSET_DICT_INIT;
+	return 0;
+}
+
+// slot of id, or the empty slot where it belongs
+long itemset_dict_find(itemset_dict_t *d, int id)
+{
+	long i = ((unsigned long)id*0x9e3779b97f4a7c15UL>>17) & (d->cap-1);
+	while (d->slots[i].key!=id && d->slots[i].key!=-1)
+		i = (i+1) & (d->cap-1);
+	return i;
+}
+
+// doubles the table, keeping it at most half full
+int itemset_dict_grow(itemset_dict_t *d)
+{
+	long i, cap = d->cap;
+	itemset_slot_t *slots = d->slots;
 	
-	bag = (itemset_bag_t *)malloc(sizeof(itemset_bag_t));
-	if (!bag)
-		goto e1;
+	d->slots = (itemset_slot_t *)malloc(2*cap*sizeof(itemset_slot_t));
+	if (!d->slots)
+	{
+		d->slots = slots;
+		return -1;
+	}
+	memset(d->slots, 0xff, 2*cap*sizeof(itemset_slot_t));
+	d->cap = 2*cap;
+	for (i=0; i<cap; i++)
+		if (slots[i].key != -1)
+			d->slots[itemset_dict_find(d, slots[i].key)] = slots[i];
+	free(slots);
+	return 0;
+}
+
+// adds n to the support of id
+int itemset_dict_count(itemset_dict_t *d, int id, long n)
+{
+	long i = itemset_dict_find(d, id);
+	if (d->slots[i].key == -1)
+	{
+		if (2*(d->len+1) > d->cap)
+		{
+			if (itemset_dict_grow(d))
+				return -1;
+			i = itemset_dict_find(d, id);
+		}
+		d->slots[i].key = id;
+		d->slots[i].val = 0;
+		d->len++;
+	}
+	d->slots[i].val += n;
+	return 0;
+}
+
+// adds the supports of src to d
+int itemset_dict_merge(itemset_dict_t *d, itemset_dict_t *src)
+{
+	long i;
+	for (i=0; i<src->cap; i++)
+		if (src->slots[i].key!=-1 && itemset_dict_count(d, src->slots[i].key, src->slots[i].val))
+			return -1;
+	return 0;
+}
+
+int itemset_dict_cmp(const void *a, const void *b)
+{
+	return *(int *)a<*(int *)b? -1: *(int *)a>*(int *)b;
+}
+
+// assigns dense ids to the counted ids in ascending order, which keeps the order of items
+int itemset_dict_rank(itemset_dict_t *d)
+{
+	long i, n;
 	
-	fp = fopen(path, "rb");
-	if (!fp)
-		goto e2;
+	// an empty dictionary still has item 0, which must not look frequent
+	d->ids = (int *)calloc(d->len+1, sizeof(int));
+	d->supports = (long *)calloc(d->len+1, sizeof(long));
+	if (!d->ids || !d->supports)
+		return -1;
+	for (i=0, n=0; i<d->cap; i++)
+		if (d->slots[i].key != -1)
+			d->ids[n++] = d->slots[i].key;
+	qsort(d->ids, n, sizeof(int), itemset_dict_cmp);
+	for (i=0; i<n; i++)
+	{
+		long j = itemset_dict_find(d, d->ids[i]);
+		d->supports[i] = d->slots[j].val;
+		d->slots[j].val = i;
+	}
+	return 0;
+}
+
+// dense id of a ranked id or -1
+int itemset_dict_get(itemset_dict_t *d, int id)
+{
+	long i = itemset_dict_find(d, id);
+	return d->slots[i].key==id? d->slots[i].val: -1;
+}
+
+void itemset_dict_free(itemset_dict_t *d)
+{
+	free(d->slots);
+	free(d->ids);
+	free(d->supports);
+	memset(d, 0, sizeof(itemset_dict_t));
+}
+
+// first pass. counts transactions and items, checks characters and counts the supports of
+// the items into the dictionary of the worker
+void itemset_count(void *arg, int worker)
+{
+	itemset_chunk_t *c = (itemset_chunk_t *)arg;
+	itemset_classify_t classify = c->classify;
+	long *low = c->counts[worker].low;
+	itemset_dict_t *dict = &c->counts[worker].dict;
+	const char *p, *end = c->end;
+	const char *q;
+	char buf[ITEMSET_BLOCK+ITEMSET_WORD];
+	uint64_t pnum = 0, pnl = 1; // the byte before the block is a digit, a newline
+	long ntran = 0, nitem = 0;
 	
-	long size; // length of input in bytes
-	fseek(fp , 0L , SEEK_END);
-	size = ftell(fp);
-	rewind(fp);
+	for (p=c->start; p<end; p+=ITEMSET_BLOCK)
+	{
+		itemset_mask_t m = classify(q=itemset_block(p, end, buf));
+		uint64_t bad = ~(m.num|m.sep|m.nl);
+		if (bad)
+		{
+			c->error = p-c->data+__builtin_ctzll(bad);
+			return;
+		}
+		uint64_t lines = ~m.nl & (m.nl<<1 | pnl);
+		uint64_t starts = m.num & ~(m.num<<1 | pnum);
+		ntran += __builtin_popcountll(lines);
+		nitem += __builtin_popcountll(starts);
+		for (; starts; starts&=starts-1)
+		{
+			int s = __builtin_ctzll(starts);
+			int item = itemset_decode(q+s, p+s, end, m.num>>s, ITEMSET_BLOCK-s);
+			if ((unsigned)item < ITEMSET_LOW)
+				low[item]++;
+			else if (itemset_dict_count(dict, item, 1))
+			{
+				c->nomem = 1;
+				return;
+			}
+		}
+		pnum = m.num>>63;
+		pnl = m.nl>>63;
+	}
+	c->ntran = ntran;
+	c->nitem = nitem;
+}
+
+// counts the lines of a chunk, which are its transactions
+void itemset_lines(void *arg, int worker)
+{
+	itemset_chunk_t *c = (itemset_chunk_t *)arg;
+	const char *p, *end = c->end;
+	char buf[ITEMSET_BLOCK+ITEMSET_WORD];
+	uint64_t pnl = 1;
+	long ntran = 0;
 	
-	buf = malloc(size+1);
-	if(!buf) 
-		goto e3;
+	for (p=c->start; p<end; p+=ITEMSET_BLOCK)
+	{
+		itemset_mask_t m = c->classify(itemset_block(p, end, buf));
+		ntran += __builtin_popcountll(~m.nl & (m.nl<<1 | pnl));
+		pnl = m.nl>>63;
+	}
+	c->ntran = ntran;
+}
+
+// start of line k of a chunk, or its end if it has k lines
+const char *itemset_line_at(itemset_chunk_t *c, long k)
+{
+	const char *p, *end = c->end;
+	char buf[ITEMSET_BLOCK+ITEMSET_WORD];
+	uint64_t pnl = 1;
 	
-	if(fread(buf, size, 1, fp) != 1)
-		goto e4;
-	if (buf[size-1] != '\n')
+	for (p=c->start; p<end; p+=ITEMSET_BLOCK)
 	{
-		buf[size] = '\n';
-		size++;
+		itemset_mask_t m = c->classify(itemset_block(p, end, buf));
+		uint64_t lines = ~m.nl & (m.nl<<1 | pnl);
+		long n = __builtin_popcountll(lines);
+		if (k < n)
+		{
+			for (; k>0; k--)
+				lines &= lines-1;
+			return p+__builtin_ctzll(lines);
+		}
+		k -= n;
+		pnl = m.nl>>63;
 	}
+	return end;
+}
+
+// second pass. parses the items into their place in the bag, mapped if the ids are sparse
+void itemset_parse(void *arg, int worker)
+{
+	itemset_chunk_t *c = (itemset_chunk_t *)arg;
+	itemset_classify_t classify = c->classify;
+	itemset_dict_t *map = c->map;
+	const char *p, *end = c->end;
+	const char *q;
+	char buf[ITEMSET_BLOCK+ITEMSET_WORD];
+	uint64_t pnum = 0, pnl = 1;
+	long *offsets = c->bag->offsets+c->tran;
+	int *items = c->bag->items+c->item;
 	
-	long ntran; // numebr of transactions
-	long l; // line number
-	for (l=0, i=0, ntran=0; i<size;)
+	for (p=c->start; p<end; p+=ITEMSET_BLOCK)
 	{
-		while (!IS_NEWLINE(buf[i]) && i<size)
+		itemset_mask_t m = classify(q=itemset_block(p, end, buf));
+		uint64_t lines = ~m.nl & (m.nl<<1 | pnl);
+		uint64_t starts = m.num & ~(m.num<<1 | pnum);
+		long first = items-c->bag->items;
+		// a line starts at the items that start before it in the block
+		for (; lines; lines&=lines-1)
+			*offsets++ = first+__builtin_popcountll(starts & ((1ULL<<__builtin_ctzll(lines))-1));
+		for (; starts; starts&=starts-1)
 		{
-			if (!IS_VALID(buf[i]))
-			{
-				printf("invalid character %02x at line %ld\n", buf[i], l);
-				goto e4;
-			}
-			i++;
+			int s = __builtin_ctzll(starts);
+			int item = itemset_decode(q+s, p+s, end, m.num>>s, ITEMSET_BLOCK-s);
+			*items++ = map? itemset_dict_get(map, item): item;
 		}
-		ntran++;
-		while (IS_NEWLINE(buf[i]) && i<size)
+		pnum = m.num>>63;
+		pnl = m.nl>>63;
+	}
+}
+
+// start of the line after the one at p
+const char *itemset_next_line(const char *p, const char *end)
+{
+	const char *q = memchr(p, '\n', end-p);
+	return q? q+1: end;
+}
+
+// a range of the items of a bag to map to dense ids
+typedef struct
+{
+	itemset_dict_t *dict;
+	int *items;
+	long len;
+} itemset_remap_t;
+
+void itemset_remap(void *arg, int worker)
+{
+	itemset_remap_t *r = (itemset_remap_t *)arg;
+	long i;
+	for (i=0; i<r->len; i++)
+		r->items[i] = itemset_dict_get(r->dict, r->items[i]);
+}
+
+// counts for every worker, so that they count supports without locks
+itemset_counts_t *itemset_counts_create(int n)
+{
+	int i;
+	itemset_counts_t *counts = (itemset_counts_t *)calloc(n, sizeof(itemset_counts_t));
+	if (!counts)
+		return NULL;
+	for (i=0; i<n; i++)
+		if (!(counts[i].low=(long *)calloc(ITEMSET_LOW, sizeof(long))) || itemset_dict_init(&counts[i].dict))
 		{
-			if (!IS_VALID(buf[i]))
+			free(counts[i].low);
+			while (i--)
 			{
-				printf("invalid character %02x at line %ld\n", buf[i], l);
-				goto e4;
+				free(counts[i].low);
+				itemset_dict_free(&counts[i].dict);
 			}
-			i++;
-			l++;
+			free(counts);
+			return NULL;
 		}
+	return counts;
+}
+
+void itemset_counts_free(itemset_counts_t *counts, int n)
+{
+	int i;
+	for (i=0; i<n; i++)
+	{
+		free(counts[i].low);
+		itemset_dict_free(&counts[i].dict);
 	}
-	long nmax = (long)round(frac*ntran);
+	free(counts);
+}
+
+// numbers the items of a bag from the supports the n workers counted, which are merged into
+// the first. ids are sparse when the largest one outnumbers the distinct ones. the bag gets
+// the supports of dense ids. sparse ones are ranked in the dictionary of the first worker,
+// and the bag takes over the original ids and their supports
+int itemset_bag_number(itemset_bag_t *bag, itemset_counts_t *counts, int n)
+{
+	long i, j, len;
+	int item_max = 0;
+	long *low = counts->low;
+	itemset_dict_t *d = &counts->dict;
 	
-	bag->itemsets = (itemset_t *)malloc((nmax)*sizeof(itemset_t));
-	if (!bag->itemsets)
-		goto e4;
-	bag->len = nmax;
-	bag->item_max = 0;
+	for (i=1; i<n; i++)
+	{
+		for (j=0; j<ITEMSET_LOW; j++)
+			low[j] += counts[i].low[j];
+		if (itemset_dict_merge(d, &counts[i].dict))
+			return -1;
+	}
+	for (i=0, len=d->len; i<ITEMSET_LOW; i++)
+		if (low[i])
+		{
+			item_max = i;
+			len++;
+		}
+	for (i=0; i<d->cap; i++)
+		if (d->slots[i].key > item_max)
+			item_max = d->slots[i].key;
+	if (item_max < ITEMSET_SPARSE*(len+1))
+	{
+		bag->supports = (long *)calloc(item_max+1, sizeof(long));
+		if (!bag->supports)
+			return -1;
+		memcpy(bag->supports, low, (item_max<ITEMSET_LOW? item_max+1: ITEMSET_LOW)*sizeof(long));
+		for (i=0; i<d->cap; i++)
+			if (d->slots[i].key != -1)
+				bag->supports[d->slots[i].key] = d->slots[i].val;
+		bag->item_max = item_max;
+		return 0;
+	}
+	for (i=0; i<ITEMSET_LOW; i++)
+		if (low[i] && itemset_dict_count(d, i, low[i]))
+			return -1;
+	if (itemset_dict_rank(d))
+		return -1;
+	bag->ids = d->ids;
+	bag->supports = d->supports;
+	bag->item_max = d->len-1;
+	d->ids = NULL;
+	d->supports = NULL;
+	return 0;
+}
+
+// maps the sparse ids of a bag parsed as they were to the dense ones of a ranked dictionary
+int itemset_bag_remap(itemset_bag_t *bag, itemset_dict_t *dict, pool_t *pool, long n)
+{
+	long i, nitem = bag->offsets[bag->len];
+	itemset_remap_t *ranges;
 	
-	long start, end; // start and end of current line
-	int nitem;
-	for (i=0, start=0, end=0, ntran=0; ntran<nmax && i<size;)
+	ranges = (itemset_remap_t *)malloc(n*sizeof(itemset_remap_t));
+	if (!ranges)
+		return -1;
+	for (i=0; i<n; i++)
 	{
-		while (!IS_NEWLINE(buf[i]) && i<size)
-			i++;
-		end = i;
-		
-		for (j=start, nitem=0; j<end;)
-		{
-			while (!IS_SEP(buf[j]) && j<end)
-				j++;
-			nitem++;
-			while (IS_SEP(buf[j]) && j<size)
-				j++;
-		}
-		bag->itemsets[ntran].items = (int*)malloc((nitem)*sizeof(int));
-		if (!bag->itemsets[ntran].items)
-			goto e5;		
-		bag->itemsets[ntran].len = nitem;
+		ranges[i].dict = dict;
+		ranges[i].items = bag->items+nitem*i/n;
+		ranges[i].len = nitem*(i+1)/n-nitem*i/n;
+		if (pool)
+			pool_submit(pool, itemset_remap, ranges+i);
+		else
+			itemset_remap(ranges+i, 0);
+	}
+	if (pool)
+		pool_run(pool);
+	free(ranges);
+	return 0;
+}
+
+// points a bag into a mapped binary dataset. returns 0 or -1 if it is not valid
+int itemset_bin_open(itemset_bag_t *bag, char *data, long size, double frac)
+{
+	itemset_bin_header_t *h = (itemset_bin_header_t *)data;
+	long i, end;
+	
+	if (h->version!=ITEMSET_BIN_VERSION || h->len<0 || h->nitem<0 || h->item_max<0
+		|| h->len>=size/sizeof(long) || h->nitem>=size/sizeof(int))
+		return -1;
+	end = sizeof(itemset_bin_header_t)+(h->len+1)*sizeof(long)+(h->nitem*sizeof(int)+7)/8*8;
+	bag->supports = (h->flags & ITEMSET_BIN_SUPPORTS)? (long *)(data+end): NULL;
+	if (bag->supports)
+		end += (h->item_max+1)*sizeof(long);
+	bag->ids = (h->flags & ITEMSET_BIN_IDS)? (int *)(data+end): NULL;
+	if (bag->ids)
+		end += (h->item_max+1)*sizeof(int);
+	if (size < end)
+		return -1;
+	bag->offsets = (long *)(data+sizeof(itemset_bin_header_t));
+	bag->items = (int *)(bag->offsets+h->len+1);
+	bag->len = h->len;
+	bag->item_max = h->item_max;
+	// supports are of all transactions. a fraction of them has to count again
+	if (frac < 1.0)
+	{
+		bag->len = (long)round(frac*h->len);
+		bag->supports = NULL;
+	}
+	// the offsets of the read part are checked before use. items are checked against
+	// item_max where they are used, so that opening does not touch them
+	if (bag->offsets[0]!=0 || bag->offsets[h->len]!=h->nitem)
+		return -1;
+	for (i=0; i<bag->len; i++)
+		if (bag->offsets[i+1]<bag->offsets[i] || bag->offsets[i+1]>h->nitem)
+			return -1;
+	return 0;
+}
+
+// tells if a mapped dataset is binary
+int itemset_bin_is(char *data, long size)
+{
+	return size>=sizeof(itemset_bin_header_t) && memcmp(data, ITEMSET_BIN_MAGIC, 8)==0;
+}
+
+// splits data up to end into n chunks at line boundaries. base is the offset of data in the
+// input. the chunks count supports into counts
+void itemset_chunks_split(itemset_chunk_t *chunks, long n, itemset_bag_t *bag, const char *data, const char *end, long base, itemset_counts_t *counts)
+{
+	long i;
+	itemset_classify_t classify = itemset_classify_select();
+	
+	for (i=0; i<n; i++)
+	{
+		chunks[i].bag = bag;
+		chunks[i].classify = classify;
+		chunks[i].data = data;
+		chunks[i].base = base;
+		chunks[i].start = i? chunks[i-1].end: data;
+		chunks[i].end = i<n-1? itemset_next_line(data+(end-data)*(i+1)/n, end): end;
+		if (chunks[i].end < chunks[i].start)
+			chunks[i].end = chunks[i].start;
+		chunks[i].counts = counts;
+		chunks[i].error = -1;
+	}
+}
+
+// first pass over n chunks
+int itemset_chunks_count(itemset_chunk_t *chunks, long n, pool_t *pool)
+{
+	long i;
+	
+	for (i=0; i<n; i++)
+		if (pool)
+			pool_submit(pool, itemset_count, chunks+i);
+		else
+			itemset_count(chunks+i, 0);
+	if (pool)
+		pool_run(pool);
+	for (i=0; i<n; i++)
+		if (chunks[i].nomem)
+			return -1;
+		else if (chunks[i].error >= 0)
+		{
+			if (chunks[i].path)
+				printf("invalid character %02x at byte %ld of %s\n", chunks[i].data[chunks[i].error], chunks[i].base+chunks[i].error, chunks[i].path);
+			else
+				printf("invalid character %02x at byte %ld\n", chunks[i].data[chunks[i].error], chunks[i].base+chunks[i].error);
+			return -1;
+		}
+	return 0;
+}
+
+// second pass over n counted chunks. appends them one after the other to the bag, their
+// ids mapped by map unless it is NULL
+int itemset_chunks_parse(itemset_bag_t *bag, itemset_chunk_t *chunks, long n, itemset_dict_t *map, pool_t *pool)
+{
+	long i, len = bag->len, nitem = bag->offsets? bag->offsets[bag->len]: 0;
+	long *offsets;
+	int *items;
+	
+	for (i=0; i<n; i++)
+	{
+		chunks[i].tran = len;
+		chunks[i].item = nitem;
+		chunks[i].map = map;
+		len += chunks[i].ntran;
+		nitem += chunks[i].nitem;
+	}
+	offsets = (long *)realloc(bag->offsets, (len+1)*sizeof(long));
+	if (!offsets)
+		return -1;
+	bag->offsets = offsets;
+	items = (int *)realloc(bag->items, (nitem+1)*sizeof(int));
+	if (!items)
+		return -1;
+	bag->items = items;
+	bag->len = len;
+	bag->offsets[len] = nitem;
+	for (i=0; i<n; i++)
+		if (pool)
+			pool_submit(pool, itemset_parse, chunks+i);
+		else
+			itemset_parse(chunks+i, 0);
+	if (pool)
+		pool_run(pool);
+	return 0;
+}
+
+// counts and parses n chunks split with counts for nthreads workers. the items are numbered
+// between the passes, so that sparse ids are mapped as they are parsed
+int itemset_chunks_read(itemset_bag_t *bag, itemset_chunk_t *chunks, long n, itemset_counts_t *counts, int nthreads, pool_t *pool)
+{
+	if (itemset_chunks_count(chunks, n, pool) || itemset_bag_number(bag, counts, nthreads))
+		return -1;
+	return itemset_chunks_parse(bag, chunks, n, bag->ids? &counts->dict: NULL, pool);
+}
+
+// end of the first fraction of the transactions of data up to end. the lines of the chunks
+// are counted first, and the chunk that holds the last transaction is cut after it
+const char *itemset_text_end(itemset_chunk_t *chunks, long n, const char *data, const char *end, double frac, pool_t *pool)
+{
+	long i, ntran = 0, nmax;
+	
+	itemset_chunks_split(chunks, n, NULL, data, end, 0, NULL);
+	for (i=0; i<n; i++)
+		if (pool)
+			pool_submit(pool, itemset_lines, chunks+i);
+		else
+			itemset_lines(chunks+i, 0);
+	if (pool)
+		pool_run(pool);
+	for (i=0; i<n; i++)
+		ntran += chunks[i].ntran;
+	nmax = (long)round(frac*ntran);
+	for (i=0; i<n && nmax>chunks[i].ntran; i++)
+		nmax -= chunks[i].ntran;
+	return i<n? itemset_line_at(chunks+i, nmax): end;
+}
+
+// parses a mapped text dataset into arrays of its own
+int itemset_text_parse(itemset_bag_t *bag, char *data, long size, double frac, int nthreads)
+{
+	long n;
+	int r = -1;
+	itemset_chunk_t *chunks;
+	itemset_counts_t *counts;
+	pool_t *pool = NULL;
+	const char *end = data+size;
+	
+	if (nthreads < 1)
+		nthreads = 1;
+	n = nthreads*ITEMSET_CHUNKS;
+	chunks = (itemset_chunk_t *)calloc(n, sizeof(itemset_chunk_t));
+	if (!chunks)
+		goto e1;
+	counts = itemset_counts_create(nthreads);
+	if (!counts)
+		goto e2;
+	if (nthreads > 1)
+		pool = pool_create(nthreads);
+	if (frac < 1.0)
+		end = itemset_text_end(chunks, n, data, end, frac, pool);
+	itemset_chunks_split(chunks, n, bag, data, end, 0, counts);
+	if (itemset_chunks_read(bag, chunks, n, counts, nthreads, pool))
+		goto e3;
+	r = 0;
+
+e3:
+	if (pool)
+		pool_free(pool);
+	itemset_counts_free(counts, nthreads);
+e2:
+	free(chunks);
+e1:
+	return r;
+}
+
+// hands a segment over to the parser, waiting while ITEMSET_QUEUE of them wait to be parsed.
+// returns -1 and frees the segment once the parser stopped
+int itemset_reader_put(itemset_reader_t *r, itemset_segment_t *s, int done)
+{
+	int stop;
+	pthread_mutex_lock(&r->mutex);
+	while (s && r->queued>=ITEMSET_QUEUE && !r->stop)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	stop = r->stop;
+	if (s && !stop)
+	{
+		s->next = NULL;
+		*r->tail = s;
+		r->tail = &s->next;
+		r->queued++;
+	}
+	if (done)
+		r->done = done;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+	if (s && stop)
+	{
+		free(s->data);
+		free(s);
+	}
+	return stop? -1: 0;
+}
+
+// next segment read, or NULL at the end of the input
+itemset_segment_t *itemset_reader_get(itemset_reader_t *r)
+{
+	itemset_segment_t *s;
+	pthread_mutex_lock(&r->mutex);
+	while (!r->head && !r->done)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	s = r->head;
+	if (s)
+	{
+		r->head = s->next;
+		if (!r->head)
+			r->tail = &r->head;
+		r->queued--;
+	}
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+	return s;
+}
+
+// stops the reader, which may wait for input or for room in the queue
+void itemset_reader_stop(itemset_reader_t *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	r->stop = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+	if (write(r->wake[1], "", 1) < 0)
+		fprintf(stderr, "can not wake the reader\n");
+}
+
+// waits for input. returns -1 once the reader is stopped
+int itemset_reader_wait(itemset_reader_t *r)
+{
+	struct pollfd fds[2] = {{r->fd, POLLIN, 0}, {r->wake[0], POLLIN, 0}};
+	while (poll(fds, 2, -1) < 0)
+		if (errno != EINTR)
+			return -1;
+	return fds[1].revents? -1: 0;
+}
+
+// reads fd into segments that end at line boundaries, while the segments read so far
+// are parsed
+void *itemset_reader(void *arg)
+{
+	itemset_reader_t *r = (itemset_reader_t *)arg;
+	itemset_segment_t *s;
+	char *buf = NULL, *next;
+	long cap = 0, len = 0, base = 0, k;
+	ssize_t n;
+	
+	for (;;)
+	{
+		// a line longer than a segment grows it
+		if (len == cap)
+		{
+			cap = cap? 2*cap: ITEMSET_SEGMENT;
+			next = (char *)realloc(buf, cap);
+			if (!next)
+				goto e1;
+			buf = next;
+		}
+		if (itemset_reader_wait(r))
+			goto e1;
+		n = read(r->fd, buf+len, cap-len);
+		if (n<0 && errno==EINTR)
+			continue;
+		if (n < 0)
+			goto e1;
+		if (n == 0)
+			break;
+		len += n;
+		if (len < cap)
+			continue;
 		
-		long istart, iend; // start and end of current item
-		for (j=start, nitem=0, istart=start, iend=start; j<end;)
-		{
-			while (!IS_SEP(buf[j]) && j<end)
-				j++;
-			iend = j;
-			char tmp = buf[end];
-			buf[iend] = '\0';
-			int item = atoi(buf+istart);
-			bag->itemsets[ntran].items[nitem] = item;
-			if (item>bag->item_max)
-				bag->item_max = item;
-			buf[iend] = tmp;
-			nitem++;
-			while (IS_SEP(buf[j]) && j<size)
-				j++;
-			istart = j;
-		}
-		ntran++;
-		while (IS_NEWLINE(buf[i]) && i<size)
-			i++;
-		start = i;
-	}
-	fclose(fp);
+		// a full segment ends after its last line. the rest starts the next one
+		for (k=len; k>0 && buf[k-1]!='\n'; k--);
+		if (k == 0)
+			continue;
+		s = (itemset_segment_t *)malloc(sizeof(itemset_segment_t));
+		next = (char *)malloc(cap);
+		if (!s || !next)
+		{
+			free(s);
+			free(next);
+			goto e1;
+		}
+		memcpy(next, buf+k, len-k);
+		s->data = buf;
+		s->size = k;
+		s->base = base;
+		buf = next;
+		base += k;
+		len -= k;
+		if (itemset_reader_put(r, s, 0))
+			goto e1;
+	}
+	
+	s = NULL;
+	if (len > 0)
+	{
+		s = (itemset_segment_t *)malloc(sizeof(itemset_segment_t));
+		if (!s)
+			goto e1;
+		s->data = buf;
+		s->size = len;
+		s->base = base;
+	}
+	else
+		free(buf);
+	itemset_reader_put(r, s, 1);
+	return NULL;
+
+e1:
 	free(buf);
-	return bag;
+	itemset_reader_put(r, NULL, -1);
+	return NULL;
+}
+
+void itemset_segment_free(itemset_segment_t *s)
+{
+	free(s->data);
+	free(s);
+}
+
+// parses a stream that can not be mapped, like a pipe. a reader thread reads it into
+// segments while each segment read is parsed with the ids as they are and freed. sparse
+// ids are mapped once the stream ended
+int itemset_stream_parse(itemset_bag_t *bag, int fd, int nthreads)
+{
+	long m, nseg = 0;
+	int r = -1;
+	itemset_reader_t reader;
+	pthread_t thread;
+	itemset_segment_t *s;
+	itemset_chunk_t *chunks;
+	itemset_counts_t *counts;
+	pool_t *pool = NULL;
+	
+	if (nthreads < 1)
+		nthreads = 1;
+	m = nthreads*ITEMSET_CHUNKS;
+	chunks = (itemset_chunk_t *)calloc(m, sizeof(itemset_chunk_t));
+	if (!chunks)
+		goto e1;
+	counts = itemset_counts_create(nthreads);
+	if (!counts)
+		goto e2;
+	memset(&reader, 0, sizeof(reader));
+	reader.fd = fd;
+	reader.tail = &reader.head;
+	if (pipe(reader.wake))
+		goto e3;
+	pthread_mutex_init(&reader.mutex, NULL);
+	pthread_cond_init(&reader.cond, NULL);
+	if (pthread_create(&thread, NULL, itemset_reader, &reader))
+		goto e4;
+	
+	if (nthreads > 1)
+		pool = pool_create(nthreads);
+	while ((s=itemset_reader_get(&reader)))
+	{
+		if (s->base==0 && itemset_bin_is(s->data, s->size))
+		{
+			printf("binary datasets can not be streamed\n");
+			itemset_segment_free(s);
+			goto e5;
+		}
+		itemset_chunks_split(chunks, m, bag, s->data, s->data+s->size, s->base, counts);
+		if (itemset_chunks_count(chunks, m, pool) || itemset_chunks_parse(bag, chunks, m, NULL, pool))
+		{
+			itemset_segment_free(s);
+			goto e5;
+		}
+		itemset_segment_free(s);
+		nseg++;
+	}
+	if (reader.done<0 || !nseg)
+		goto e5;
+	if (itemset_bag_number(bag, counts, nthreads))
+		goto e5;
+	if (bag->ids && itemset_bag_remap(bag, &counts->dict, pool, m))
+		goto e5;
+	r = 0;
 
 e5:
-	itemset_bag_free(bag);
+	// on an error the reader is woken from its read and stops
+	if (r)
+		itemset_reader_stop(&reader);
+	pthread_join(thread, NULL);
+	while (reader.head)
+	{
+		s = reader.head;
+		reader.head = s->next;
+		itemset_segment_free(s);
+	}
+	if (pool)
+		pool_free(pool);
 e4:
-	free(buf);
+	pthread_mutex_destroy(&reader.mutex);
+	pthread_cond_destroy(&reader.cond);
+	close(reader.wake[0]);
+	close(reader.wake[1]);
 e3:
-	fclose(fp);
+	itemset_counts_free(counts, nthreads);
+e2:
+	free(chunks);
+e1:
+	return r;
+}
+
+// reads a text or binary dataset. a binary one is used in place. a text one that is not a
+// regular file, like a pipe, is streamed
+itemset_bag_t *itemset_bag_create(char *path, double frac, int nthreads)
+{
+	int fd;
+	struct stat st;
+	char *data;
+	itemset_bag_t *bag;
+	
+	bag = (itemset_bag_t *)calloc(1, sizeof(itemset_bag_t));
+	if (!bag)
+		goto e1;
+	
+	// - is the standard input
+	fd = strcmp(path, "-")? open(path, O_RDONLY): dup(STDIN_FILENO);
+	if (fd < 0)
+		goto e2;
+	if (fstat(fd, &st))
+		goto e3;
+	if (!S_ISREG(st.st_mode))
+	{
+		if (frac < 1.0)
+		{
+			printf("a fraction of the dataset needs a regular file\n");
+			goto e3;
+		}
+		if (itemset_stream_parse(bag, fd, nthreads))
+		{
+			itemset_bag_free(bag);
+			bag = NULL;
+		}
+		close(fd);
+		return bag;
+	}
+	if (st.st_size == 0)
+		goto e3;
+	data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto e3;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	
+	if (itemset_bin_is(data, st.st_size))
+	{
+		if (itemset_bin_open(bag, data, st.st_size, frac))
+		{
+			printf("invalid binary dataset\n");
+			goto e4;
+		}
+		bag->data = data;
+		bag->size = st.st_size;
+	}
+	else
+	{
+		int r = itemset_text_parse(bag, data, st.st_size, frac, nthreads);
+		munmap(data, st.st_size);
+		if (r)
+		{
+			itemset_bag_free(bag);
+			bag = NULL;
+		}
+	}
+	close(fd);
+	return bag;
+
+e4:
+	munmap(data, st.st_size);
+e3:
+	close(fd);
 e2:
 	free(bag);
 e1:	
 	return NULL;
+}
+
+// reads text datasets that are shards of one, in order. all shards are split into chunks
+// together, with chunks in proportion to their size, so that they are parsed in parallel
+// however many there are and their transactions follow each other
+itemset_bag_t *itemset_bag_shards(char **paths, int len, int nthreads)
+{
+	int i, fd;
+	long j, k, m, n = 0, total = 0;
+	struct stat st;
+	char **data;
+	long *size;
+	itemset_chunk_t *chunks = NULL;
+	itemset_counts_t *counts = NULL;
+	pool_t *pool = NULL;
+	itemset_bag_t *bag;
+	
+	bag = (itemset_bag_t *)calloc(1, sizeof(itemset_bag_t));
+	data = (char **)calloc(len, sizeof(char *));
+	size = (long *)calloc(len, sizeof(long));
+	if (!bag || !data || !size)
+		goto e1;
+	for (i=0; i<len; i++)
+	{
+		fd = open(paths[i], O_RDONLY);
+		if (fd < 0)
+		{
+			printf("can not read shard %s\n", paths[i]);
+			goto e2;
+		}
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		{
+			printf("shard %s is not a regular file\n", paths[i]);
+			close(fd);
+			goto e2;
+		}
+		// empty shards add nothing
+		if (st.st_size > 0)
+		{
+			data[i] = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data[i] == MAP_FAILED)
+			{
+				data[i] = NULL;
+				printf("can not read shard %s\n", paths[i]);
+				close(fd);
+				goto e2;
+			}
+			size[i] = st.st_size;
+			madvise(data[i], size[i], MADV_SEQUENTIAL);
+		}
+		close(fd);
+		if (itemset_bin_is(data[i], size[i]))
+		{
+			printf("binary dataset %s can not be a shard\n", paths[i]);
+			goto e2;
+		}
+		total += size[i];
+	}
+	if (total == 0)
+		goto e2;
+	
+	if (nthreads < 1)
+		nthreads = 1;
+	m = nthreads*ITEMSET_CHUNKS;
+	chunks = (itemset_chunk_t *)calloc(m+len, sizeof(itemset_chunk_t));
+	counts = itemset_counts_create(nthreads);
+	if (!chunks || !counts)
+		goto e3;
+	if (nthreads > 1)
+		pool = pool_create(nthreads);
+	for (i=0; i<len; i++)
+	{
+		if (!size[i])
+			continue;
+		k = 1+m*size[i]/total;
+		itemset_chunks_split(chunks+n, k, bag, data[i], data[i]+size[i], 0, counts);
+		for (j=0; j<k; j++)
+			chunks[n+j].path = paths[i];
+		n += k;
+	}
+	if (itemset_chunks_read(bag, chunks, n, counts, nthreads, pool))
+		goto e3;
+	if (pool)
+		pool_free(pool);
+	itemset_counts_free(counts, nthreads);
+	free(chunks);
+	for (i=0; i<len; i++)
+		if (data[i])
+			munmap(data[i], size[i]);
+	free(data);
+	free(size);
+	return bag;
+
+e3:
+	if (pool)
+		pool_free(pool);
+	if (counts)
+		itemset_counts_free(counts, nthreads);
+	free(chunks);
+	itemset_bag_free(bag);
+	bag = NULL;
+e2:
+	for (i=0; i<len; i++)
+		if (data[i])
+			munmap(data[i], size[i]);
+e1:
+	free(data);
+	free(size);
+	free(bag);
+	return NULL;
+}
+
+// writes a bag as a binary dataset, with the supports of its items if they are known and
+// the original ids if they were mapped
+int itemset_bag_write(itemset_bag_t *bag, char *path)
+{
+	long i, nitem = bag->offsets[bag->len]-bag->offsets[0];
+	int r = -1;
+	FILE *fp;
+	long *supports = bag->supports;
+	itemset_bin_header_t h;
+	static const char pad[8];
+	
+	fp = fopen(path, "wb");
+	if (!fp)
+		goto e1;
+	
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ITEMSET_BIN_MAGIC, 8);
+	h.version = ITEMSET_BIN_VERSION;
+	h.item_max = bag->item_max;
+	h.len = bag->len;
+	h.nitem = nitem;
+	h.flags = (supports? ITEMSET_BIN_SUPPORTS: 0) | (bag->ids? ITEMSET_BIN_IDS: 0);
+	if (fwrite(&h, sizeof(h), 1, fp) != 1)
+		goto e3;
+	for (i=0; i<=bag->len; i++)
+	{
+		long o = bag->offsets[i]-bag->offsets[0];
+		if (fwrite(&o, sizeof(long), 1, fp) != 1)
+			goto e3;
+	}
+	if (fwrite(bag->items+bag->offsets[0], sizeof(int), nitem, fp) != nitem)
+		goto e3;
+	if (fwrite(pad, 1, (8-nitem*sizeof(int)%8)%8, fp) != (8-nitem*sizeof(int)%8)%8)
+		goto e3;
+	if (supports && fwrite(supports, sizeof(long), bag->item_max+1, fp) != bag->item_max+1)
+		goto e3;
+	if (bag->ids && fwrite(bag->ids, sizeof(int), bag->item_max+1, fp) != bag->item_max+1)
+		goto e3;
+	r = 0;
+
+e3:
+	if (fclose(fp))
+		r = -1;
+e1:
+	return r;
+}
+
+// scans a mapped binary dataset in parts of about ITEMSET_SCAN_WINDOW bytes of items. supports
+// it does not hold are counted first
+long itemset_bin_scan(char *data, long size, double frac, itemset_func_t init, itemset_func_t func, void *arg)
+{
+	long i, j, ntran = -1, *supports = NULL;
+	itemset_bag_t bag, part;
 	
+	if (itemset_bin_open(&bag, data, size, frac))
+		goto e1;
+	if (!bag.supports)
+	{
+		supports = (long *)calloc(bag.item_max+1, sizeof(long));
+		if (!supports)
+			return -1;
+		for (i=0; i<bag.offsets[bag.len]; i++)
+		{
+			if ((unsigned)bag.items[i] > (unsigned)bag.item_max)
+				goto e1;
+			supports[bag.items[i]]++;
+		}
+		bag.supports = supports;
+	}
+	if (init(arg, &bag, 0))
+		goto e2;
+	part = bag;
+	for (i=0; i<bag.len; i=j)
+	{
+		for (j=i+1; j<bag.len && bag.offsets[j+1]-bag.offsets[i]<=ITEMSET_SCAN_WINDOW/sizeof(int); j++)
+			;
+		part.offsets = bag.offsets+i;
+		part.len = j-i;
+		if (func(arg, &part, i))
+			goto e2;
+	}
+	ntran = bag.len;
+	goto e2;
 
+e1:
+	printf("invalid binary dataset\n");
+e2:
+	free(supports);
+	return ntran;
 }
 
-void itemset_free(itemset_t *itemset)
+// reads the first fraction of a dataset without keeping its transactions, a window of about
+// ITEMSET_SCAN_WINDOW bytes at a time, with the chunks of a dataset read at once on nthreads
+// threads. the first pass counts the supports of the items and keeps the counts of the chunks.
+// init gets them in a bag without transactions, whose items are numbered like those of a bag
+// read at once. the second pass parses the windows again and passes their transactions to
+// func. returns the number of transactions or -1
+long itemset_scan(char *path, double frac, int nthreads, itemset_func_t init, itemset_func_t func, void *arg)
 {
-	free(itemset->items);
+	int fd;
+	struct stat st;
+	char *data;
+	const char *p, *end, *next, *done;
+	long n, w, i, nwin = 0, ntran = -1;
+	itemset_chunk_t *chunks, *grown;
+	itemset_counts_t *counts;
+	itemset_bag_t head, part;
+	pool_t *pool = NULL;
+	
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto e1;
+	if (fstat(fd, &st) || st.st_size == 0)
+		goto e2;
+	data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto e2;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	if (itemset_bin_is(data, st.st_size))
+	{
+		ntran = itemset_bin_scan(data, st.st_size, frac, init, func, arg);
+		goto e3;
+	}
+	
+	if (nthreads < 1)
+		nthreads = 1;
+	n = nthreads*ITEMSET_CHUNKS;
+	chunks = (itemset_chunk_t *)calloc(n, sizeof(itemset_chunk_t));
+	if (!chunks)
+		goto e3;
+	counts = itemset_counts_create(nthreads);
+	if (!counts)
+		goto e4;
+	memset(&head, 0, sizeof(head));
+	memset(&part, 0, sizeof(part));
+	if (nthreads > 1)
+		pool = pool_create(nthreads);
+	end = data+st.st_size;
+	if (frac < 1.0)
+		end = itemset_text_end(chunks, n, data, end, frac, pool);
+	for (p=data, done=data; p<end; p=next, nwin++)
+	{
+		next = end-p>ITEMSET_SCAN_WINDOW? itemset_next_line(p+ITEMSET_SCAN_WINDOW, end): end;
+		grown = (itemset_chunk_t *)realloc(chunks, (nwin+1)*n*sizeof(itemset_chunk_t));
+		if (!grown)
+			goto e5;
+		chunks = grown;
+		memset(chunks+nwin*n, 0, n*sizeof(itemset_chunk_t));
+		itemset_chunks_split(chunks+nwin*n, n, &part, p, next, p-data, counts);
+		if (itemset_chunks_count(chunks+nwin*n, n, pool))
+			goto e5;
+		for (i=0; i<n; i++)
+			head.len += chunks[nwin*n+i].ntran;
+		// drop the pages behind so that the input never stays resident
+		if (next-done >= ITEMSET_SCAN_WINDOW)
+		{
+			const char *to = data+((next-data)/ITEMSET_SCAN_WINDOW)*ITEMSET_SCAN_WINDOW;
+			madvise((char *)done, to-done, MADV_DONTNEED);
+			done = to;
+		}
+	}
+	if (itemset_bag_number(&head, counts, nthreads) || init(arg, &head, 0))
+		goto e5;
+	for (w=0, done=data, ntran=0; w<nwin; w++)
+	{
+		part.len = 0;
+		if (itemset_chunks_parse(&part, chunks+w*n, n, head.ids? &counts->dict: NULL, pool))
+			goto e6;
+		part.item_max = head.item_max;
+		if (func(arg, &part, ntran))
+			goto e6;
+		ntran += part.len;
+		next = chunks[w*n+n-1].end;
+		if (next-done >= ITEMSET_SCAN_WINDOW)
+		{
+			const char *to = data+((next-data)/ITEMSET_SCAN_WINDOW)*ITEMSET_SCAN_WINDOW;
+			madvise((char *)done, to-done, MADV_DONTNEED);
+			done = to;
+		}
+	}
+	goto e7;
+
+e6:
+	ntran = -1;
+e7:
+	free(part.offsets);
+	free(part.items);
+e5:
+	free(head.supports);
+	free(head.ids);
+	if (pool)
+		pool_free(pool);
+	itemset_counts_free(counts, nthreads);
+e4:
+	free(chunks);
+e3:
+	munmap(data, st.st_size);
+e2:
+	close(fd);
+e1:
+	return ntran;
 }
 
 void itemset_bag_free(itemset_bag_t *bag)
 {
-	long i;
-	for (i=0; i<bag->len; i++)
-		itemset_free(bag->itemsets+i);
-	free(bag->itemsets);
+	if (bag->data)
+		munmap(bag->data, bag->size);
+	else
+	{
+		free(bag->offsets);
+		free(bag->items);
+		free(bag->supports);
+		free(bag->ids);
+	}
 	free(bag);
 }
-
@@ -1,21 +1,66 @@
 #ifndef ITEMSET_H
 #define ITEMSET_H
 
+// transactions in compressed sparse rows. the items of transaction i are
+// items[offsets[i]] to items[offsets[i+1]-1]
 typedef struct
 {
-	int len;
+	long len;
+	int item_max;
+	long *offsets;
 	int *items;
-} itemset_t;
+	long *supports; // transactions of each item up to item_max, or NULL if not known
+	int *ids; // original id of each item when sparse ids were mapped to dense ones, or NULL
+	char *data; // mapped binary dataset the arrays point into, or NULL if they are owned
+	long size;
+} itemset_bag_t;
+
+// binary dataset. the header is followed by the offsets, the items padded to a multiple
+// of 8 bytes, with ITEMSET_BIN_SUPPORTS the supports and with ITEMSET_BIN_IDS the
+// original ids of the items. numbers are in host byte order
+#define ITEMSET_BIN_MAGIC		"BITECLAT"
+#define ITEMSET_BIN_VERSION		1
+#define ITEMSET_BIN_SUPPORTS	1
+#define ITEMSET_BIN_IDS			2
 
 typedef struct
 {
-	long len;
+	char magic[8];
+	int version;
 	int item_max;
-	itemset_t *itemsets;
-} itemset_bag_t;
+	long len;
+	long nitem;
+	long flags;
+	long reserved[3];
+} itemset_bin_header_t;
+
+// a slot of a dictionary. a key and its value share a cache line
+typedef struct
+{
+	int key; // original id. -1 in an empty slot
+	long val; // support while counting, dense id once ranked
+} itemset_slot_t;
+
+// maps sparse item ids to dense ones, which are assigned in ascending order of the ids
+typedef struct
+{
+	long cap;
+	long len;
+	itemset_slot_t *slots;
+	int *ids; // original id of each dense id, once ranked
+	long *supports; // support of each dense id, once ranked
+} itemset_dict_t;
+
+// receives the transactions of a part of a scan, the first one as tid. non-zero return
+// stops the scan with an error
+typedef int (*itemset_func_t)(void *arg, itemset_bag_t *part, long tid);
 
-itemset_bag_t *itemset_bag_create(char *path, double frac);
-void itemset_free(itemset_t *itemset);
+itemset_bag_t *itemset_bag_create(char *path, double frac, int nthreads);
+itemset_bag_t *itemset_bag_shards(char **paths, int len, int nthreads);
+int itemset_bag_write(itemset_bag_t *bag, char *path);
+long itemset_scan(char *path, double frac, int nthreads, itemset_func_t init, itemset_func_t func, void *arg);
+int itemset_dict_get(itemset_dict_t *d, int id);
+void itemset_dict_free(itemset_dict_t *d);
 void itemset_bag_free(itemset_bag_t *bag);
 
-#endif
\ No newline at end of file
+#endif
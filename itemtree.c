@@ -3,35 +3,121 @@
 #include "itemtree.h"
 #include "bitset.h"
 
-itemnode_t *itemtree_create(bitset_bag_t *bag, long minsup)
+#define ITEMTREE_ARENA_CHUNK	4096
+
+// a node and its bitset header are allocated together
+typedef struct
 {
-	int i;
-	itemnode_t *node, *left;
-	itemnode_t *hooker = (itemnode_t *)malloc(sizeof(itemnode_t));
-	hooker->right = NULL;
+	itemnode_t node;
+	bitset_t bitset;
+} itemtree_slot_t;
+
+typedef struct
+{
+	long card;
+	int item;
+} itemtree_rank_t;
+
+int itemtree_rank_cmp(const void *a, const void *b)
+{
+	const itemtree_rank_t *x = (const itemtree_rank_t *)a, *y = (const itemtree_rank_t *)b;
+	if (x->card != y->card)
+		return x->card<y->card? -1: 1;
+	return x->item - y->item;
+}
+
+// with ITEMTREE_ORDER_SUPPORT items are renumbered by their rank in ascending support, so that
+// the rest of the tree code keeps comparing item numbers. tree->items maps them back
+itemtree_t *itemtree_create(bitset_bag_t *bag, long minsup, int narenas, int order)
+{
+	int i, n;
+	itemtree_t *tree;
+	itemtree_rank_t *ranks;
+	itemnode_t *left;
+	itemnode_t hooker;
 	
-	for (i=0; i<bag->len; i++)
+	tree = (itemtree_t *)malloc(sizeof(itemtree_t));
+	if (!tree)
+		goto e1;
+	tree->root = NULL;
+	tree->items = NULL;
+	tree->narenas = narenas>0? narenas: 1;
+	tree->arenas = (arena_t *)malloc(tree->narenas*sizeof(arena_t));
+	if (!tree->arenas)
+		goto e2;
+	for (i=0; i<tree->narenas; i++)
+		arena_init(tree->arenas+i, sizeof(itemtree_slot_t), ITEMTREE_ARENA_CHUNK);
+	
+	ranks = (itemtree_rank_t *)malloc(bag->len*sizeof(itemtree_rank_t));
+	if (!ranks)
+		goto e3;
+	for (i=0, n=0; i<bag->len; i++)
 	{
 		if (bag->bitsets[i].card >= minsup)
 		{
-			itemnode_t *n = (itemnode_t *)malloc(sizeof(itemnode_t));
-			n->item = i;
-			n->bitset = bag->bitsets+i; // copying is expensive. point to the one in the bitset bag
-			n->down = NULL;
-			n->up = NULL;
-			for (left=hooker, node=hooker->right; node!=NULL && node->item<n->item; left=node, node=node->right)
-				;
-			left->right = n;
-			n->right = node;
-		}		
-		else
+			ranks[n].card = bag->bitsets[i].card;
+			ranks[n].item = i;
+			n++;
+		}
+		else if (bag->bitsets[i].bitmap)
 		{
 			bitset_free(bag->bitsets+i);
+			bag->bitsets[i].bitmap = NULL;
 		}
 	}
-	node = hooker->right;
-	free(hooker);
-	return node;
+	if (order == ITEMTREE_ORDER_SUPPORT)
+		qsort(ranks, n, sizeof(itemtree_rank_t), itemtree_rank_cmp);
+	// items mapped to dense ids are numbered by rank too, and map straight to their original ids
+	if (order==ITEMTREE_ORDER_SUPPORT || bag->ids)
+	{
+		tree->items = (int *)malloc((n>0? n: 1)*sizeof(int));
+		if (!tree->items)
+			goto e4;
+		for (i=0; i<n; i++)
+			tree->items[i] = bag->ids? bag->ids[ranks[i].item]: ranks[i].item;
+	}
+	
+	hooker.right = NULL;
+	for (i=0, left=&hooker; i<n; i++)
+	{
+		bitset_t *b = bag->bitsets+ranks[i].item;
+		// only the header is copied. the bitmap itself now belongs to the tree
+		itemnode_t *node = itemtree_node_create(tree, 0, tree->items? i: ranks[i].item, b->bitmap, b->card);
+		if (!node)
+			goto e4;
+		b->bitmap = NULL;
+		node->up = NULL;
+		node->right = NULL;
+		left->right = node;
+		left = node;
+	}
+	tree->root = hooker.right;
+	free(ranks);
+	return tree;
+
+e4:
+	free(ranks);
+e3:
+	itemtree_free(tree);
+	return NULL;
+e2:
+	free(tree);
+e1:
+	return NULL;
+}
+
+itemnode_t *itemtree_node_create(itemtree_t *tree, int arena, int item, wrapped_bitmap_t *bitmap, long card)
+{
+	itemtree_slot_t *slot = (itemtree_slot_t *)arena_alloc(tree->arenas+arena);
+	if (!slot)
+		return NULL;
+	itemnode_t *n = &slot->node;
+	n->item = item;
+	n->bitset = &slot->bitset;
+	n->bitset->bitmap = bitmap;
+	n->bitset->card = card;
+	n->down = NULL;
+	return n;
 }
 
 void itemtree_insert_down(itemnode_t *parent, itemnode_t *child)
@@ -52,24 +138,61 @@ void itemtree_insert_down(itemnode_t *parent, itemnode_t *child)
 	child->up = parent;
 }
 
-void itemtree_print_rec(itemnode_t *node, int level)
+int itemtree_card_cmp(const void *a, const void *b)
+{
+	const itemnode_t *x = *(itemnode_t * const *)a, *y = *(itemnode_t * const *)b;
+	if (x->bitset->card != y->bitset->card)
+		return x->bitset->card<y->bitset->card? -1: 1;
+	return x->item - y->item;
+}
+
+// reorders the children of parent by ascending support
+void itemtree_sort_down(itemnode_t *parent)
+{
+	int i, n;
+	itemnode_t *node, **nodes;
+	
+	for (n=0, node=parent->down; node!=NULL; node=node->right)
+		n++;
+	if (n < 2)
+		return;
+	nodes = (itemnode_t **)malloc(n*sizeof(itemnode_t *));
+	if (!nodes)
+		return; // order is only a matter of speed
+	for (i=0, node=parent->down; node!=NULL; i++, node=node->right)
+		nodes[i] = node;
+	qsort(nodes, n, sizeof(itemnode_t *), itemtree_card_cmp);
+	parent->down = nodes[0];
+	for (i=0; i<n-1; i++)
+		nodes[i]->right = nodes[i+1];
+	nodes[n-1]->right = NULL;
+	free(nodes);
+}
+
+// original id of an item of the tree
+int itemtree_item_id(itemtree_t *tree, int item)
+{
+	return tree->items? tree->items[item]: item;
+}
+
+void itemtree_print_rec(itemtree_t *tree, itemnode_t *node, int level)
 {
 	int i;
 	for (i=0; i<level; i++)
 		printf(" ");
-	printf("%d", node->item);
+	printf("%d", itemtree_item_id(tree, node->item));
 	printf(" (%lu)", node->bitset->card);
 	printf("\n");
 	if (node->down)
-		itemtree_print_rec(node->down, level+1);
+		itemtree_print_rec(tree, node->down, level+1);
 	if (node->right)
-		itemtree_print_rec(node->right, level);
+		itemtree_print_rec(tree, node->right, level);
 }
 
-void itemtree_print(itemnode_t *root)
+void itemtree_print(itemtree_t *tree)
 {
-	if (root)
-		itemtree_print_rec(root, 0);
+	if (tree->root)
+		itemtree_print_rec(tree, tree->root, 0);
 }
 
 int itemtree_count(itemnode_t *root)
@@ -129,15 +252,23 @@ long itemtree_maximal_len_sum(itemnode_t *root)
 		return itemtree_maximal_len_sum_rec(root, 1);
 }
 
-void itemtree_free(itemnode_t *root)
+void itemtree_slot_free(void *obj)
 {
-	if (root)
+	itemtree_slot_t *slot = (itemtree_slot_t *)obj;
+	if (slot->bitset.bitmap)
+		bitset_free(&slot->bitset);
+}
+
+// nodes go with their arena chunks. only the bitmaps need a visit each
+void itemtree_free(itemtree_t *tree)
+{
+	int i;
+	for (i=0; i<tree->narenas; i++)
 	{
-		if (root->down)
-			itemtree_free(root->down);
-		if (root->right)
-			itemtree_free(root->right);
-		bitset_free(root->bitset);
-		free(root);
+		arena_walk(tree->arenas+i, itemtree_slot_free);
+		arena_destroy(tree->arenas+i);
 	}
+	free(tree->arenas);
+	free(tree->items);
+	free(tree);
 }
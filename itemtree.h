@@ -2,6 +2,7 @@
 #define ITEMTREE_H
 
 #include "bitset.h"
+#include "arena.h"
 
 typedef struct itemnode
 {
@@ -13,13 +14,28 @@ typedef struct itemnode
 	struct itemnode *up;
 } itemnode_t;
 
+// order of the items in the tree
+#define ITEMTREE_ORDER_ID		0	// by item id
+#define ITEMTREE_ORDER_SUPPORT	1	// by ascending support
+
+typedef struct
+{
+	itemnode_t *root;
+	int *items; // original id of each item when the tree is not in id order. NULL otherwise
+	int narenas;
+	arena_t *arenas; // nodes and their bitset headers. one arena per mining thread
+} itemtree_t;
+
+itemnode_t *itemtree_node_create(itemtree_t *tree, int arena, int item, wrapped_bitmap_t *bitmap, long card);
 void itemtree_insert_down(itemnode_t *parent, itemnode_t *child);
-itemnode_t *itemtree_create(bitset_bag_t *bag, long minsup);
-void itemtree_print(itemnode_t *root);
+void itemtree_sort_down(itemnode_t *parent);
+int itemtree_item_id(itemtree_t *tree, int item);
+itemtree_t *itemtree_create(bitset_bag_t *bag, long minsup, int narenas, int order);
+void itemtree_print(itemtree_t *tree);
 int itemtree_count(itemnode_t *root);
 int itemtree_count_maximal(itemnode_t *root);
 long itemtree_len_sum(itemnode_t *root);
 long itemtree_maximal_len_sum(itemnode_t *root);
-void itemtree_free(itemnode_t *root);
+void itemtree_free(itemtree_t *tree);
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -3,28 +3,64 @@
 #include <unistd.h>
 #include <math.h>
 #include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "itemset.h"
 #include "itemtree.h"
 #include "eclat.h"
+#include "charm.h"
+#include "genmax.h"
+#include "rules.h"
+#include "cache.h"
 #include "stats.h"
 #ifdef MEMPROF
 #include <gperftools/heap-profiler.h>
 #endif
 
+// mining algorithms
+#define ALG_ECLAT	0
+#define ALG_DECLAT	1
+#define ALG_HYBRID	2
+#define ALG_CLOSED	3
+#define ALG_MAXIMAL	4
+
+// backends one run can mine with
+#define BACKEND_MAX	16
+
 int verbosity = 0;
 
 void print_help(FILE *fp)
 {
 	fprintf(fp, "usage: eclat [options]\n");
+	fprintf(fp, "       eclat convert <dataset> <binary>   convert a dataset to the binary format\n");
 	fprintf(fp, "options:\n");
-	fprintf(fp, "-d <dataset>  dataset file. csv of numbers. one transaction per line\n");
+	fprintf(fp, "-a <alg>      mining algorithm. eclat, declat (diffsets), hybrid (tidsets switching to diffsets)\n");
+	fprintf(fp, "              closed (closed itemsets only) or maximal (maximal itemsets only). default eclat\n");
+	fprintf(fp, "-b <backend>  bitmap backend. roaring, bm, ewah, concise, dense or auto (the fastest on a sample of the\n");
+	fprintf(fp, "              bitsets). several separated by commas mine the dataset read once with each. default %s\n", wrapped_bitmap_backend());
+	fprintf(fp, "-C <dir>      cache bitsets in dir. later runs on the same dataset and fraction load them from there\n");
+	fprintf(fp, "-c <conf>     generate association rules with at least this confidence from the frequent itemsets\n");
+	fprintf(fp, "-d <dataset>  dataset file, - for stdin. csv of numbers, one transaction per line, or binary\n");
+	fprintf(fp, "              a directory, a glob or repeated -d read text files as shards of one dataset\n");
 	fprintf(fp, "-f <frac>     fraction of transactions to process from start. default 1.0\n");
 	fprintf(fp, "-h            print help\n");
 	fprintf(fp, "-H            print header\n");
+	fprintf(fp, "-l            low memory. build bitmaps while reading without keeping transactions\n");
+	fprintf(fp, "              and free bitmaps of itemsets as soon as mining no longer needs them\n");
 	fprintf(fp, "-m <sup>      minimum support. default 0.1\n");
+	fprintf(fp, "-o <order>    item order. id, support (ascending) or dynamic (ascending support at every level). default id\n");
 	fprintf(fp, "-p            print frequent patterns\n");
-	fprintf(fp, "-s            print stats\n");
+	fprintf(fp, "-r <file>     write association rules to file. - for stdout. default stdout\n");
+	fprintf(fp, "-s            print stats. time and memory from reading the dataset to the end of mining\n");
+	fprintf(fp, "-t <threads>  number of mining threads. 0 for one per core. default 1\n");
 	fprintf(fp, "-v            be verbose\n");
+	fprintf(fp, "-w <file>     write frequent patterns to file as they are found, without keeping them. - for stdout\n");
 }
 
 void verbose(char *fmt, ...)
@@ -39,21 +75,179 @@ void verbose(char *fmt, ...)
 	va_end(args);	
 }
 
+int dataset_push(char ***paths, int *len, char *path)
+{
+	char **p = (char **)realloc(*paths, (*len+1)*sizeof(char *));
+	if (!p)
+		return -1;
+	*paths = p;
+	if (!(p[*len] = strdup(path)))
+		return -1;
+	(*len)++;
+	return 0;
+}
+
+int dataset_hidden(const struct dirent *d)
+{
+	return d->d_name[0] != '.';
+}
+
+// adds the files of a -d argument to paths. it is a file, a directory whose files are taken
+// in name order or a glob. a glob that matches nothing is taken as it is
+int dataset_add(char *arg, char ***paths, int *len)
+{
+	glob_t g;
+	struct stat st;
+	struct dirent **names;
+	char path[PATH_MAX];
+	size_t i;
+	int j, n, failed = 0, r = -1;
+	
+	if (glob(arg, GLOB_NOCHECK, NULL, &g))
+		return -1;
+	for (i=0; i<g.gl_pathc; i++)
+	{
+		if (stat(g.gl_pathv[i], &st) || !S_ISDIR(st.st_mode))
+		{
+			if (dataset_push(paths, len, g.gl_pathv[i]))
+				goto e1;
+			continue;
+		}
+		n = scandir(g.gl_pathv[i], &names, dataset_hidden, alphasort);
+		if (n < 0)
+			goto e1;
+		// only the regular files of a directory are taken
+		for (j=0; j<n; j++)
+		{
+			if (!failed && snprintf(path, sizeof(path), "%s/%s", g.gl_pathv[i], names[j]->d_name) < sizeof(path)
+				&& !stat(path, &st) && S_ISREG(st.st_mode) && dataset_push(paths, len, path))
+				failed = 1;
+			free(names[j]);
+		}
+		free(names);
+		if (failed)
+			goto e1;
+	}
+	r = 0;
+
+e1:
+	globfree(&g);
+	return r;
+}
+
+// writes a dataset in the binary format that loads without parsing
+int convert(char *infile, char *outfile)
+{
+	itemset_bag_t *ibag = itemset_bag_create(infile, 1.0, sysconf(_SC_NPROCESSORS_ONLN));
+	if (!ibag)
+	{
+		fprintf(stderr, "can not read infile %s\n", infile);
+		return 1;
+	}
+	verbose("read %ld transactions\n", ibag->len);
+	if (itemset_bag_write(ibag, outfile))
+	{
+		fprintf(stderr, "can not write outfile %s\n", outfile);
+		itemset_bag_free(ibag);
+		return 1;
+	}
+	itemset_bag_free(ibag);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int c;
 	char *infile = NULL;
+	char **infiles = NULL;
+	int ninfile = 0, nprev;
 	double minsupf = 0.1;
 	long minsup;
 	int printhd = 0, printfp = 0, printst = 0;
 	double frac = 1.0;
+	int alg = ALG_ECLAT;
+	int nthreads = 1;
+	int order = ITEMTREE_ORDER_ID;
+	int flags = 0;
+	char *outfile = NULL;
+	double minconf = -1;
+	char *rulefile = "-";
+	char *cachedir = NULL;
+	char *backends[BACKEND_MAX];
+	int nbackend = 0, b;
+	char *name;
+	const char *fallback = wrapped_bitmap_backend();
+	bitset_tune_t tune;
+	itemset_bag_t *ibag = NULL;
 	
-	while ((c=getopt(argc, argv, "d:f:hHm:psv")) != -1)
+	if (argc>1 && strcmp(argv[1], "convert")==0)
+	{
+		if (argc != 4)
+		{
+			print_help(stderr);
+			exit(1);
+		}
+		return convert(argv[2], argv[3]);
+	}
+	
+	while ((c=getopt(argc, argv, "a:b:C:c:d:f:hHlm:o:pr:st:vw:")) != -1)
 	{
 		switch (c)
 		{
+			case 'a':
+				if (strcmp(optarg, "eclat")==0)
+					alg = ALG_ECLAT;
+				else if (strcmp(optarg, "declat")==0)
+					alg = ALG_DECLAT;
+				else if (strcmp(optarg, "hybrid")==0)
+					alg = ALG_HYBRID;
+				else if (strcmp(optarg, "closed")==0)
+					alg = ALG_CLOSED;
+				else if (strcmp(optarg, "maximal")==0)
+					alg = ALG_MAXIMAL;
+				else
+				{
+					fprintf(stderr, "invalid algorithm %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'b':
+				nbackend = 0;
+				for (name=strtok(optarg, ","); name; name=strtok(NULL, ","))
+				{
+					if ((strcmp(name, "auto") && wrapped_bitmap_select(name)) || nbackend==BACKEND_MAX)
+					{
+						fprintf(stderr, "invalid backend %s\n", name);
+						exit(1);
+					}
+					backends[nbackend++] = name;
+				}
+				break;
+			case 'C':
+				cachedir = optarg;
+				break;
+			case 'c':
+				minconf = atof(optarg);
+				if (minconf<0 || minconf>1)
+				{
+					fprintf(stderr, "invalid minconf %s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'd':
-				infile = optarg;
+				nprev = ninfile;
+				if (dataset_add(optarg, &infiles, &ninfile))
+				{
+					fprintf(stderr, "can not read infile %s\n", optarg);
+					exit(1);
+				}
+				if (ninfile == nprev)
+				{
+					fprintf(stderr, "no dataset files in %s\n", optarg);
+					exit(1);
+				}
+				if (!infile)
+					infile = optarg;
 				break;
 			case 'h':
 				print_help(stdout);
@@ -61,6 +255,9 @@ int main(int argc, char *argv[])
 			case 'H':
 				printhd = 1;
 				break;
+			case 'l':
+				flags |= ECLAT_LOWMEM;
+				break;
 			case 'm':
 				minsupf = atof(optarg);
 				if (minsupf<=0)
@@ -77,62 +274,268 @@ int main(int argc, char *argv[])
 					exit(1);
 				}
 				break;
+			case 'o':
+				if (strcmp(optarg, "id")==0)
+					order = ITEMTREE_ORDER_ID;
+				else if (strcmp(optarg, "support")==0)
+					order = ITEMTREE_ORDER_SUPPORT;
+				else if (strcmp(optarg, "dynamic")==0)
+				{
+					order = ITEMTREE_ORDER_SUPPORT;
+					flags |= ECLAT_REORDER;
+				}
+				else
+				{
+					fprintf(stderr, "invalid item order %s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'p':
 				printfp = 1;
 				break;
+			case 'r':
+				rulefile = optarg;
+				break;
 			case 's':
 				printst = 1;
 				break;
+			case 't':
+				nthreads = atoi(optarg);
+				if (nthreads<0)
+				{
+					fprintf(stderr, "invalid number of threads %s\n", optarg);
+					exit(1);
+				}
+				if (nthreads==0)
+					nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+				break;
 			case 'v':
 				verbosity = 1;
 				break;
+			case 'w':
+				outfile = optarg;
+				break;
 			default:
 				print_help(stderr);
 				exit(1);
 		}
 	}
 
-	if (!printhd && !infile)
+	if (!printhd && !ninfile)
 	{
 		print_help(stderr);
 		exit(1);
 	}
 
+	// shards are read together into one dataset
+	if (ninfile>1 && ((flags & ECLAT_LOWMEM) || frac<1.0))
+	{
+		fprintf(stderr, "several dataset files are read together. can not use -l or -f with them\n");
+		exit(1);
+	}
+
+	// every backend builds its bitsets from the transactions kept in memory and mines them anew
+	if (nbackend>1 && ((flags & ECLAT_LOWMEM) || outfile || minconf>=0))
+	{
+		fprintf(stderr, "several backends mine the same transactions. can not use -l, -w or -c with them\n");
+		exit(1);
+	}
+	if (!nbackend)
+		backends[nbackend++] = (char *)fallback;
+
+	// standard input and other streams can only be read once
+	for (c=0; c<ninfile && ((flags & ECLAT_LOWMEM) || cachedir); c++)
+	{
+		struct stat st;
+		if (strcmp(infiles[c], "-")==0 || (stat(infiles[c], &st)==0 && !S_ISREG(st.st_mode)))
+		{
+			fprintf(stderr, "%s is a stream and read only once. can not use -l or -C with it\n", infiles[c]);
+			exit(1);
+		}
+	}
+
+	// rules look up supports of subsets in the tree
+	if (minconf>=0 && (outfile || alg==ALG_CLOSED || alg==ALG_MAXIMAL))
+	{
+		fprintf(stderr, "association rules need all frequent itemsets in memory. can not use -c with -w, closed or maximal\n");
+		exit(1);
+	}
+
 	stat_init();
 
 	if (printhd)
 	{
 		stat_head(stdout);
-		printf(",count,count_maximal,avg,avg_maximal\n");
+		printf(",count,count_maximal,avg,avg_maximal,peak_memory,backend\n");
 	}
 
-	itemnode_t *root;
-	if (infile)
+	itemtree_t *tree;
+	sink_t *sink = NULL;
+	FILE *outfp = NULL;
+	for (b=0; ninfile && b<nbackend; b++)
 	{
-		verbose("reading %2.1f%% of input file %s\n", frac*100, infile);
-		itemset_bag_t *ibag = itemset_bag_create(infile, frac);
-		if (!ibag)
+		// all tidsets of the previous backend are freed by now. auto starts from the default one
+		wrapped_bitmap_select(strcmp(backends[b], "auto")? backends[b]: fallback);
+		if (outfile)
 		{
-			fprintf(stderr, "can not read infile %s\n", argv[2]);
-			exit(1);
+			outfp = strcmp(outfile, "-")==0? stdout: fopen(outfile, "w");
+			if (outfp)
+				sink = sink_file_create(outfp, nthreads);
+			if (!sink)
+			{
+				fprintf(stderr, "can not write outfile %s\n", outfile);
+				exit(1);
+			}
+		}
+		// closed and maximal itemsets are not a prefix tree. they always go to a sink
+		else if (alg==ALG_CLOSED || alg==ALG_MAXIMAL)
+		{
+			outfp = stdout;
+			sink = printfp? sink_file_create(outfp, nthreads): sink_null_create(nthreads);
+			if (!sink)
+			{
+				fprintf(stderr, "can not create pattern sink\n");
+				exit(1);
+			}
 		}
-		verbose("read %ld transactions\n", ibag->len);
-		minsup = (long)(ceil(minsupf*ibag->len));
-		verbose("minimum support is %2.1f%% = %ld\n", minsupf*100, minsup);
 
-		if (printst)		
+		bitset_bag_t *bbag = NULL;
+		int cached = 0;
+		char cachefile[CACHE_PATH_MAX];
+		if (cachedir && cache_path(cachefile, sizeof(cachefile), cachedir, infiles, ninfile, frac))
+		{
+			fprintf(stderr, "can not read infile %s\n", infile);
+			exit(1);
+		}
+		// reading is measured too, since -l can not read without creating bitsets. transactions
+		// reused from the previous backend are not read again
+		if (printst)
 			stat_start();
 #ifdef MEMPROF
 		HeapProfilerStart("memprof");
 #endif
+		if (cachedir)
+		{
+			// loading cached bitsets replaces both reading and creating them
+			bbag = cache_load(cachefile);
+			cached = bbag!=NULL;
+			verbose("%s bitsets in cache %s\n", bbag? "found": "no", cachefile);
+		}
+		if (!bbag && (flags & ECLAT_LOWMEM))
+		{
+			verbose("reading %2.1f%% of input file %s\n", frac*100, infile);
+			// the transactions are never kept. building bitsets is part of reading then.
+			// cached bitsets serve any minsup
+			verbose("creating bitsets while reading\n");
+			bbag = bitset_bag_load(infiles[0], frac, cachedir? 0: minsupf, nthreads);
+			if (!bbag)
+			{
+				fprintf(stderr, "can not read infile %s\n", infile);
+				exit(1);
+			}
+		}
+		else if (!bbag)
+		{
+			if (ibag)
+				verbose("reusing %ld transactions\n", ibag->len);
+			else if (ninfile > 1)
+			{
+				verbose("reading %d shards of %s\n", ninfile, infile);
+				ibag = itemset_bag_shards(infiles, ninfile, nthreads);
+			}
+			else
+			{
+				verbose("reading %2.1f%% of input file %s\n", frac*100, infiles[0]);
+				ibag = itemset_bag_create(infiles[0], frac, nthreads);
+			}
+			if (!ibag)
+			{
+				fprintf(stderr, "can not read infile %s\n", infile);
+				exit(1);
+			}
+			verbose("creating %s bitsets\n", wrapped_bitmap_backend());
+			bbag = bitset_bag_create(ibag, cachedir? 0: (long)(ceil(minsupf*ibag->len)), nthreads);
+			// the transactions are kept for the next backend
+			if (b == nbackend-1)
+			{
+				itemset_bag_free(ibag);
+				ibag = NULL;
+			}
+			if (!bbag)
+			{
+				fprintf(stderr, "can not create bitsets\n");
+				exit(1);
+			}
+		}
+		// saved and mined in their most compact form
+		long saved = bitset_bag_optimize(bbag, nthreads);
+		verbose("optimizing bitsets saved %ld bytes\n", saved);
+		if (cachedir && !cached)
+		{
+			verbose("saving bitsets to cache %s\n", cachefile);
+			if (cache_save(bbag, cachefile))
+				fprintf(stderr, "can not write cache %s\n", cachefile);
+		}
+		verbose("read %ld transactions\n", bbag->ntran);
+		long ntrans = bbag->ntran;
+		// an itemset has to occur at least once, even in an empty dataset
+		minsup = ntrans>0? (long)(ceil(minsupf*ntrans)): 1;
+		verbose("minimum support is %2.1f%% = %ld\n", minsupf*100, minsup);
+
+		if (strcmp(backends[b], "auto") == 0)
+		{
+			verbose("tuning backend\n");
+			if (bitset_bag_tune(bbag, minsup, &tune))
+			{
+				fprintf(stderr, "can not tune backend\n");
+				exit(1);
+			}
+			if (tune.ncost)
+			{
+				fprintf(stderr, "auto: %d frequent bitsets of %ld to %ld tids, median %ld. %d sampled with density %f and runs of %.2f tids\n",
+					tune.len, tune.min, tune.max, tune.median, tune.nsample, tune.density, tune.run);
+				for (c=0; c<tune.ncost; c++)
+					fprintf(stderr, "auto: %-8s %12.0f ns per intersection %14zu bytes of bitsets\n", tune.costs[c].backend, tune.costs[c].ns, tune.costs[c].bytes);
+			}
+			fprintf(stderr, "auto: mining with %s\n", wrapped_bitmap_backend());
+		}
 
-		verbose("creating bitsets\n");
-		bitset_bag_t *bbag = bitset_bag_create(ibag);
-		itemset_bag_free(ibag);
 		verbose("mining bitsets\n");
-		root = itemtree_create(bbag, minsup);
+		tree = itemtree_create(bbag, minsup, nthreads, order);
 		bitset_bag_free(bbag);
-		eclat(root, minsup);
+		if (!tree)
+		{
+			fprintf(stderr, "can not create item tree\n");
+			exit(1);
+		}
+		// eclat extends nodes with the first level items only. reordering classes needs the class based miner
+		if (alg == ALG_CLOSED)
+		{
+			verbose("mining closed itemsets with 1 thread\n");
+			charm(tree, minsup, sink);
+		}
+		else if (alg == ALG_MAXIMAL)
+		{
+			verbose("mining maximal itemsets with 1 thread\n");
+			genmax(tree, minsup, sink);
+		}
+		else
+		{
+			verbose("mining with %d threads\n", nthreads);
+			if (alg==ALG_DECLAT || alg==ALG_HYBRID || (flags & ECLAT_REORDER))
+				declat(tree, minsup, alg==ALG_DECLAT? DECLAT_DIFFSET: alg==ALG_HYBRID? DECLAT_AUTO: DECLAT_TIDSET, flags, sink, nthreads);
+			else
+				eclat(tree, minsup, flags, sink, nthreads);
+		}
+		long scnt = 0, slen = 0;
+		if (sink)
+		{
+			scnt = sink_count(sink);
+			slen = sink_len_sum(sink);
+			sink_free(sink);
+			if (outfp != stdout)
+				fclose(outfp);
+		}
 		
 		if (printst)
 			stat_stop();
@@ -140,20 +543,58 @@ int main(int argc, char *argv[])
 		HeapProfilerStop();
 #endif
 
+		// rules are not part of the mining stats
+		if (minconf >= 0)
+		{
+			FILE *rulefp = strcmp(rulefile, "-")==0? stdout: fopen(rulefile, "w");
+			sink_t *rsink = rulefp? sink_file_create(rulefp, nthreads): NULL;
+			if (!rsink)
+			{
+				fprintf(stderr, "can not write rule file %s\n", rulefile);
+				exit(1);
+			}
+			verbose("generating rules with %d threads\n", nthreads);
+			long nrules = rules(tree, minconf, ntrans, rsink, nthreads);
+			sink_free(rsink);
+			if (rulefp != stdout)
+				fclose(rulefp);
+			if (nrules < 0)
+			{
+				fprintf(stderr, "can not generate rules\n");
+				exit(1);
+			}
+			verbose("generated %ld rules\n", nrules);
+		}
+
 		verbose("found frequent itemsets\n");
-		if (printfp)
-			itemtree_print(root);
-		if (printst)
+		if (printfp && !sink)
+			itemtree_print(tree);
+		if (printst && sink)
+		{
+			// maximal itemsets are not known without the tree
+			stat_log(stdout);
+			printf(",%ld,,%f,,%ld,%s\n", scnt, ((double)slen)/scnt, stat_peak_memory(), wrapped_bitmap_backend());
+		}
+		else if (printst)
 		{
 			stat_log(stdout);
-			int cnt = itemtree_count(root);
-			int mcnt = itemtree_count_maximal(root);
-			printf(",%d,%d,%f,%f\n", cnt, mcnt, ((double)itemtree_len_sum(root))/cnt, ((double)itemtree_maximal_len_sum(root))/mcnt);
+			int cnt = itemtree_count(tree->root);
+			int mcnt = itemtree_count_maximal(tree->root);
+			printf(",%d,%d,%f,%f,%ld,%s\n", cnt, mcnt, ((double)itemtree_len_sum(tree->root))/cnt, ((double)itemtree_maximal_len_sum(tree->root))/mcnt, stat_peak_memory(), wrapped_bitmap_backend());
 		}
-		itemtree_free(root);
+		itemtree_free(tree);
+#ifdef __GLIBC__
+		// memory freed by one backend is given back, so that it is not measured for the next
+		malloc_trim(0);
+#endif
 	}
 
+	if (ibag)
+		itemset_bag_free(ibag);
 	stat_finish();
+	for (c=0; c<ninfile; c++)
+		free(infiles[c]);
+	free(infiles);
 
 	return 0;
 }
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+#define POOL_DEQUE_INIT	64
+
+// index of the worker running on the current thread. -1 outside the pool
+__thread int pool_worker = -1;
+
+typedef struct
+{
+	pool_t *pool;
+	int worker;
+} pool_arg_t;
+
+pool_t *pool_create(int nthreads)
+{
+	int i;
+	pool_t *pool;
+
+	pool = (pool_t *)malloc(sizeof(pool_t));
+	if (!pool)
+		goto e1;
+	pool->len = nthreads>0? nthreads: 1;
+	pool->deques = (pool_deque_t *)malloc(pool->len*sizeof(pool_deque_t));
+	if (!pool->deques)
+		goto e2;
+	for (i=0; i<pool->len; i++)
+	{
+		pool->deques[i].tasks = (pool_task_t *)malloc(POOL_DEQUE_INIT*sizeof(pool_task_t));
+		if (!pool->deques[i].tasks)
+			goto e3;
+		pool->deques[i].top = 0;
+		pool->deques[i].bottom = 0;
+		pool->deques[i].cap = POOL_DEQUE_INIT;
+		pthread_mutex_init(&pool->deques[i].mutex, NULL);
+	}
+	pool->queued = 0;
+	pool->pending = 0;
+	pool->idle = 0;
+	pool->next = 0;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	return pool;
+
+e3:
+	while (i--)
+		free(pool->deques[i].tasks);
+	free(pool->deques);
+e2:
+	free(pool);
+e1:
+	return NULL;
+}
+
+int pool_deque_push(pool_deque_t *d, pool_task_t *t)
+{
+	pthread_mutex_lock(&d->mutex);
+	if (d->bottom == d->cap)
+	{
+		if (d->top > 0)
+		{
+			memmove(d->tasks, d->tasks+d->top, (d->bottom-d->top)*sizeof(pool_task_t));
+			d->bottom -= d->top;
+			d->top = 0;
+		}
+		else
+		{
+			pool_task_t *tasks = (pool_task_t *)realloc(d->tasks, 2*d->cap*sizeof(pool_task_t));
+			if (!tasks)
+			{
+				pthread_mutex_unlock(&d->mutex);
+				return -1;
+			}
+			d->tasks = tasks;
+			d->cap *= 2;
+		}
+	}
+	d->tasks[d->bottom++] = *t;
+	pthread_mutex_unlock(&d->mutex);
+	return 0;
+}
+
+// the owner takes the newest task, which keeps its working set hot in cache
+int pool_deque_pop(pool_deque_t *d, pool_task_t *t)
+{
+	int r = 0;
+	pthread_mutex_lock(&d->mutex);
+	if (d->bottom > d->top)
+	{
+		*t = d->tasks[--d->bottom];
+		if (d->bottom == d->top)
+			d->top = d->bottom = 0;
+		r = 1;
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return r;
+}
+
+// thieves take the oldest task, which is usually the biggest one
+int pool_deque_steal(pool_deque_t *d, pool_task_t *t)
+{
+	int r = 0;
+	pthread_mutex_lock(&d->mutex);
+	if (d->bottom > d->top)
+	{
+		*t = d->tasks[d->top++];
+		if (d->bottom == d->top)
+			d->top = d->bottom = 0;
+		r = 1;
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return r;
+}
+
+void pool_submit(pool_t *pool, pool_func_t func, void *arg)
+{
+	pool_task_t t;
+	int w = pool_worker;
+
+	t.func = func;
+	t.arg = arg;
+	// tasks from outside the pool are spread round-robin. from inside they go to own deque
+	if (w < 0)
+		w = pool->next++ % pool->len;
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+	if (pool_deque_push(pool->deques+w, &t))
+	{
+		// can not queue it. run it right away instead
+		func(arg, w);
+		__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+	__atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	// pairs with the idle increment in pool_work so that a sleeping worker never misses a task
+	if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+int pool_idle(pool_t *pool)
+{
+	return __atomic_load_n(&pool->idle, __ATOMIC_RELAXED);
+}
+
+int pool_take(pool_t *pool, int w, pool_task_t *t)
+{
+	int i;
+
+	if (pool_deque_pop(pool->deques+w, t))
+		goto found;
+	for (i=1; i<pool->len; i++)
+		if (pool_deque_steal(pool->deques+(w+i)%pool->len, t))
+			goto found;
+	return 0;
+
+found:
+	__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+void pool_work(pool_t *pool, int w)
+{
+	pool_task_t t;
+
+	pool_worker = w;
+	for (;;)
+	{
+		if (pool_take(pool, w, &t))
+		{
+			t.func(t.arg, w);
+			if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+			{
+				pthread_mutex_lock(&pool->mutex);
+				pthread_cond_broadcast(&pool->cond);
+				pthread_mutex_unlock(&pool->mutex);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		__atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) <= 0 && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		__atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->mutex);
+		if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0)
+			break;
+	}
+	pool_worker = -1;
+}
+
+void *pool_thread(void *arg)
+{
+	pool_arg_t *a = (pool_arg_t *)arg;
+	pool_work(a->pool, a->worker);
+	return NULL;
+}
+
+// runs until all submitted tasks, and the tasks they submit, are finished.
+// the calling thread takes part as worker 0
+void pool_run(pool_t *pool)
+{
+	int i;
+	pthread_t *threads = (pthread_t *)malloc(pool->len*sizeof(pthread_t));
+	pool_arg_t *args = (pool_arg_t *)malloc(pool->len*sizeof(pool_arg_t));
+	int n = 0;
+
+	if (threads && args)
+		for (i=1; i<pool->len; i++)
+		{
+			args[i].pool = pool;
+			args[i].worker = i;
+			if (pthread_create(threads+i, NULL, pool_thread, args+i) == 0)
+				n = i;
+			else
+				break;
+		}
+	pool_work(pool, 0);
+	for (i=1; i<=n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(args);
+}
+
+void pool_free(pool_t *pool)
+{
+	int i;
+	for (i=0; i<pool->len; i++)
+	{
+		free(pool->deques[i].tasks);
+		pthread_mutex_destroy(&pool->deques[i].mutex);
+	}
+	free(pool->deques);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+	free(pool);
+}
@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+// a work-stealing thread pool. each worker owns a deque of tasks. it pushes and pops
+// at the bottom of its own deque and steals from the top of the others when empty
+typedef void (*pool_func_t)(void *arg, int worker);
+
+typedef struct
+{
+	pool_func_t func;
+	void *arg;
+} pool_task_t;
+
+typedef struct
+{
+	pool_task_t *tasks;
+	long top;
+	long bottom;
+	long cap;
+	pthread_mutex_t mutex;
+} pool_deque_t;
+
+typedef struct
+{
+	int len;
+	pool_deque_t *deques;
+	long queued; // tasks waiting in deques
+	long pending; // tasks submitted and not yet finished
+	int idle; // workers waiting for a task
+	int next; // deque for the next task submitted from outside the pool
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} pool_t;
+
+pool_t *pool_create(int nthreads);
+void pool_submit(pool_t *pool, pool_func_t func, void *arg);
+int pool_idle(pool_t *pool);
+void pool_run(pool_t *pool);
+void pool_free(pool_t *pool);
+
+#endif
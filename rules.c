@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "rules.h"
+#include "pool.h"
+
+// itemsets this close to the top become separate tasks
+#define RULES_SPLIT_DEPTH	2
+#define RULES_TEXT_MAX		64
+#define RULES_CONS_INIT	1024
+
+// scratch of one thread
+typedef struct
+{
+	int *z; // items of the itemset, root first
+	int *mark; // stamp of each item in the itemset being looked up
+	int stamp;
+	int *sub; // items being looked up
+	int *cons; // consequents of the current size, as positions in z
+	int *next; // and of the next size
+	char *line; // text of the rule being written
+	long cap;
+	long count;
+} rules_worker_t;
+
+typedef struct
+{
+	itemtree_t *tree;
+	double minconf;
+	long ntrans;
+	sink_t *out;
+	pool_t *pool;
+	rules_worker_t *workers;
+	int nitems; // bound of item numbers
+	int depth; // longest itemset
+	int error; // set once a task could not allocate. the others stop then
+} rules_ctx_t;
+
+typedef struct
+{
+	rules_ctx_t *ctx;
+	itemnode_t *node;
+	int depth;
+} rules_task_t;
+
+// support of an itemset of the tree. the tree holds it on the path that takes, on every level,
+// the first node of its items in list order, since later siblings only extend with what follows
+long rules_support(rules_ctx_t *ctx, rules_worker_t *w, int *items, int len)
+{
+	int i;
+	itemnode_t *node, *list = ctx->tree->root;
+	
+	if (++w->stamp == 0)
+	{
+		memset(w->mark, 0, ctx->nitems*sizeof(int));
+		w->stamp = 1;
+	}
+	for (i=0; i<len; i++)
+		w->mark[items[i]] = w->stamp;
+	for (i=0; i<len; i++)
+	{
+		for (node=list; node!=NULL && w->mark[node->item]!=w->stamp; node=node->right)
+			;
+		if (!node)
+			return 0; // not frequent. can not happen for subsets of a frequent itemset
+		list = node->down;
+	}
+	return node->bitset->card;
+}
+
+// tells if the consequent c of m positions is in the sorted list h of n of them
+int rules_has(int *h, long n, int m, int *c)
+{
+	long lo = 0, hi = n;
+	while (lo < hi)
+	{
+		long mid = (lo+hi)/2;
+		int i, r;
+		for (i=0, r=0; i<m && r==0; i++)
+			r = h[mid*m+i]<c[i]? -1: h[mid*m+i]>c[i];
+		if (r < 0)
+			lo = mid+1;
+		else if (r > 0)
+			hi = mid;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+// doubles the consequent lists of a worker
+int rules_grow(rules_worker_t *w)
+{
+	int *cons = (int *)realloc(w->cons, 2*w->cap*sizeof(int));
+	if (!cons)
+		return -1;
+	w->cons = cons;
+	int *next = (int *)realloc(w->next, 2*w->cap*sizeof(int));
+	if (!next)
+		return -1;
+	w->next = next;
+	w->cap *= 2;
+	return 0;
+}
+
+char *rules_write(rules_ctx_t *ctx, char *line, int *items, int len)
+{
+	int i;
+	char tmp[RULES_TEXT_MAX], *p;
+	for (i=0; i<len; i++)
+	{
+		p = sink_ltoa(tmp+RULES_TEXT_MAX-1, itemtree_item_id(ctx->tree, items[i]));
+		tmp[RULES_TEXT_MAX-1] = ' ';
+		memcpy(line, p, tmp+RULES_TEXT_MAX-p);
+		line += tmp+RULES_TEXT_MAX-p;
+	}
+	return line;
+}
+
+// tests the rule z\c => c of the consequent c of m positions. writes it if confident enough
+int rules_test(rules_ctx_t *ctx, int worker, int k, long sup, int *c, int m)
+{
+	int i, j, l;
+	long xsup, ysup;
+	char *p;
+	rules_worker_t *w = ctx->workers+worker;
+	
+	// antecedent first, consequent after it
+	for (i=0, j=0, l=0; i<k; i++)
+		if (j<m && c[j]==i)
+			w->sub[k-m+j++] = w->z[i];
+		else
+			w->sub[l++] = w->z[i];
+	xsup = rules_support(ctx, w, w->sub, k-m);
+	if (xsup==0 || sup < ctx->minconf*xsup)
+		return 0;
+	
+	double conf = (double)sup/xsup;
+	ysup = rules_support(ctx, w, w->sub+k-m, m);
+	p = rules_write(ctx, w->line, w->sub, k-m);
+	memcpy(p, "=> ", 3);
+	p = rules_write(ctx, p+3, w->sub+k-m, m);
+	p += snprintf(p, RULES_TEXT_MAX, "(%ld %f %f)\n", sup, conf, ysup? conf*ctx->ntrans/ysup: 0.0);
+	sink_file_write(ctx->out, worker, w->line, p-w->line);
+	w->count++;
+	return 1;
+}
+
+// rules of the itemset ending at node. consequents grow level by level from the ones that
+// passed, since moving items from the antecedent to the consequent never raises confidence.
+// returns -1 if the consequents do not fit, since the rules would be incomplete
+int rules_itemset(rules_ctx_t *ctx, int worker, itemnode_t *node, int k)
+{
+	int i, j, l, m, *t;
+	long a, b, n, nn;
+	itemnode_t *p;
+	rules_worker_t *w = ctx->workers+worker;
+	long sup = node->bitset->card;
+	
+	for (i=k-1, p=node; i>=0; i--, p=p->up)
+		w->z[i] = p->item;
+	
+	for (i=0, n=0; i<k; i++)
+	{
+		if (n==w->cap && rules_grow(w))
+			return -1;
+		if (rules_test(ctx, worker, k, sup, &i, 1))
+			w->cons[n++] = i;
+	}
+	for (m=1; m<k-1 && n>1; m++)
+	{
+		// join consequents that differ in their last position only, and keep the candidates
+		// of which every subset passed
+		for (a=0, nn=0; a<n; a++)
+			for (b=a+1; b<n && memcmp(w->cons+a*m, w->cons+b*m, (m-1)*sizeof(int))==0; b++)
+			{
+				int *c;
+				if ((nn+1)*(m+1) > w->cap && rules_grow(w))
+					return -1;
+				c = w->next+nn*(m+1);
+				memcpy(c, w->cons+a*m, m*sizeof(int));
+				c[m] = w->cons[b*m+m-1];
+				for (l=0; l<m-1; l++)
+				{
+					// the subset without position l, rotated into the scratch after c
+					for (i=0, j=0; i<=m; i++)
+						if (i != l)
+							w->sub[j++] = c[i];
+					if (!rules_has(w->cons, n, m, w->sub))
+						break;
+				}
+				if (l<m-1 || !rules_test(ctx, worker, k, sup, c, m+1))
+					continue;
+				nn++;
+			}
+		t = w->cons;
+		w->cons = w->next;
+		w->next = t;
+		n = nn;
+	}
+	return 0;
+}
+
+void rules_task(void *arg, int worker);
+
+void rules_rec(rules_ctx_t *ctx, int worker, itemnode_t *list, int depth)
+{
+	itemnode_t *node;
+	rules_task_t *t;
+	
+	for (node=list; node!=NULL && !__atomic_load_n(&ctx->error, __ATOMIC_RELAXED); node=node->right)
+	{
+		if (depth>0 && rules_itemset(ctx, worker, node, depth+1))
+		{
+			__atomic_store_n(&ctx->error, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if (!node->down)
+			continue;
+		if (ctx->pool && depth<RULES_SPLIT_DEPTH && (t=(rules_task_t *)malloc(sizeof(rules_task_t))))
+		{
+			t->ctx = ctx;
+			t->node = node->down;
+			t->depth = depth+1;
+			pool_submit(ctx->pool, rules_task, t);
+		}
+		else
+			rules_rec(ctx, worker, node->down, depth+1);
+	}
+}
+
+void rules_task(void *arg, int worker)
+{
+	rules_task_t *t = (rules_task_t *)arg;
+	rules_rec(t->ctx, worker, t->node, t->depth);
+	free(t);
+}
+
+int rules_depth(itemnode_t *list)
+{
+	int d, max = 0;
+	itemnode_t *node;
+	for (node=list; node!=NULL; node=node->right)
+		if ((d=rules_depth(node->down)+1) > max)
+			max = d;
+	return max;
+}
+
+long rules(itemtree_t *tree, double minconf, long ntrans, sink_t *out, int nthreads)
+{
+	int i;
+	long n = -1;
+	itemnode_t *node;
+	rules_ctx_t ctx;
+	
+	ctx.tree = tree;
+	ctx.error = 0;
+	ctx.minconf = minconf;
+	ctx.ntrans = ntrans;
+	ctx.out = out;
+	ctx.depth = rules_depth(tree->root);
+	for (ctx.nitems=0, node=tree->root; node!=NULL; node=node->right)
+		if (node->item >= ctx.nitems)
+			ctx.nitems = node->item+1;
+	ctx.pool = nthreads>1? pool_create(nthreads): NULL;
+	ctx.workers = (rules_worker_t *)calloc(nthreads>1? nthreads: 1, sizeof(rules_worker_t));
+	if (!ctx.workers)
+		goto e1;
+	for (i=0; i<(nthreads>1? nthreads: 1); i++)
+	{
+		rules_worker_t *w = ctx.workers+i;
+		w->cap = RULES_CONS_INIT;
+		w->z = (int *)malloc((ctx.depth+1)*sizeof(int));
+		w->sub = (int *)malloc((ctx.depth+1)*sizeof(int));
+		w->mark = (int *)calloc(ctx.nitems+1, sizeof(int));
+		w->cons = (int *)malloc(w->cap*sizeof(int));
+		w->next = (int *)malloc(w->cap*sizeof(int));
+		w->line = (char *)malloc((ctx.depth+2)*RULES_TEXT_MAX);
+		if (!w->z || !w->sub || !w->mark || !w->cons || !w->next || !w->line)
+			goto e2;
+	}
+	
+	rules_rec(&ctx, 0, tree->root, 0);
+	if (ctx.pool)
+		pool_run(ctx.pool);
+	if (!ctx.error)
+		for (i=0, n=0; i<(nthreads>1? nthreads: 1); i++)
+			n += ctx.workers[i].count;
+
+e2:
+	for (i=0; i<(nthreads>1? nthreads: 1); i++)
+	{
+		free(ctx.workers[i].z);
+		free(ctx.workers[i].sub);
+		free(ctx.workers[i].mark);
+		free(ctx.workers[i].cons);
+		free(ctx.workers[i].next);
+		free(ctx.workers[i].line);
+	}
+	free(ctx.workers);
+e1:
+	if (ctx.pool)
+		pool_free(ctx.pool);
+	return n;
+}
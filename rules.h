@@ -0,0 +1,14 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "itemtree.h"
+#include "sink.h"
+
+// generates association rules with confidence of at least minconf from every itemset of a
+// mined tree and writes them to out, a file sink, as lines of
+//   antecedent => consequent (support confidence lift)
+// supports of antecedents and consequents are looked up in the tree. returns the number of rules,
+// or -1 if they could not all be generated
+long rules(itemtree_t *tree, double minconf, long ntrans, sink_t *out, int nthreads);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sink.h"
+
+#define SINK_BUF_SIZE	(1<<16)
+#define SINK_LINE_MAX	32 // longest text of one item or support
+
+int sink_init(sink_t *sink, int nworkers)
+{
+	sink->nworkers = nworkers>0? nworkers: 1;
+	sink->stats = (sink_stat_t *)calloc(sink->nworkers, sizeof(sink_stat_t));
+	return sink->stats? 0: -1;
+}
+
+void sink_emit(sink_t *sink, int worker, int *items, int len, long support)
+{
+	sink->stats[worker].count++;
+	sink->stats[worker].len_sum += len;
+	sink->emit(sink, worker, items, len, support);
+}
+
+long sink_count(sink_t *sink)
+{
+	int i;
+	long n;
+	for (i=0, n=0; i<sink->nworkers; i++)
+		n += sink->stats[i].count;
+	return n;
+}
+
+long sink_len_sum(sink_t *sink)
+{
+	int i;
+	long n;
+	for (i=0, n=0; i<sink->nworkers; i++)
+		n += sink->stats[i].len_sum;
+	return n;
+}
+
+// flushes whatever the sink holds and frees it
+void sink_free(sink_t *sink)
+{
+	sink->close(sink);
+	free(sink->stats);
+	free(sink);
+}
+
+// writes x backwards ending right before end. returns the start
+char *sink_ltoa(char *end, long x)
+{
+	do
+	{
+		*--end = '0' + x%10;
+		x /= 10;
+	} while (x);
+	return end;
+}
+
+void sink_file_flush(sink_file_t *f, sink_buf_t *b)
+{
+	pthread_mutex_lock(&f->mutex);
+	fwrite(b->buf, 1, b->len, f->fp);
+	pthread_mutex_unlock(&f->mutex);
+	b->len = 0;
+}
+
+void sink_file_emit(sink_t *sink, int worker, int *items, int len, long support)
+{
+	int i;
+	char tmp[SINK_LINE_MAX], *p;
+	sink_file_t *f = (sink_file_t *)sink;
+	sink_buf_t *b = f->bufs+worker;
+	
+	// items, then the support in parentheses. each piece fits in what is checked before it
+	for (i=0; i<=len; i++)
+	{
+		if (b->len+SINK_LINE_MAX > SINK_BUF_SIZE)
+			sink_file_flush(f, b);
+		if (i == len)
+			b->buf[b->len++] = '(';
+		p = sink_ltoa(tmp+SINK_LINE_MAX, i<len? items[i]: support);
+		memcpy(b->buf+b->len, p, tmp+SINK_LINE_MAX-p);
+		b->len += tmp+SINK_LINE_MAX-p;
+		b->buf[b->len++] = i<len? ' ': ')';
+	}
+	b->buf[b->len++] = '\n';
+}
+
+// one record of raw text through the buffer of a worker, for writers of other records than
+// itemsets. records that fit the buffer are never split between two flushes
+void sink_file_write(sink_t *sink, int worker, const char *s, size_t len)
+{
+	sink_file_t *f = (sink_file_t *)sink;
+	sink_buf_t *b = f->bufs+worker;
+	
+	if (b->len+len > SINK_BUF_SIZE)
+		sink_file_flush(f, b);
+	while (len > 0)
+	{
+		size_t n = SINK_BUF_SIZE-b->len<len? SINK_BUF_SIZE-b->len: len;
+		memcpy(b->buf+b->len, s, n);
+		b->len += n;
+		s += n;
+		len -= n;
+		if (b->len == SINK_BUF_SIZE)
+			sink_file_flush(f, b);
+	}
+}
+
+void sink_file_close(sink_t *sink)
+{
+	int i;
+	sink_file_t *f = (sink_file_t *)sink;
+	for (i=0; i<sink->nworkers; i++)
+	{
+		sink_file_flush(f, f->bufs+i);
+		free(f->bufs[i].buf);
+	}
+	free(f->bufs);
+	fflush(f->fp);
+	pthread_mutex_destroy(&f->mutex);
+}
+
+sink_t *sink_file_create(FILE *fp, int nworkers)
+{
+	int i;
+	sink_file_t *f;
+	
+	f = (sink_file_t *)malloc(sizeof(sink_file_t));
+	if (!f)
+		goto e1;
+	if (sink_init(&f->sink, nworkers))
+		goto e2;
+	f->sink.emit = sink_file_emit;
+	f->sink.close = sink_file_close;
+	f->fp = fp;
+	f->bufs = (sink_buf_t *)calloc(f->sink.nworkers, sizeof(sink_buf_t));
+	if (!f->bufs)
+		goto e3;
+	for (i=0; i<f->sink.nworkers; i++)
+	{
+		f->bufs[i].buf = (char *)malloc(SINK_BUF_SIZE);
+		if (!f->bufs[i].buf)
+			goto e4;
+	}
+	pthread_mutex_init(&f->mutex, NULL);
+	return &f->sink;
+
+e4:
+	while (i--)
+		free(f->bufs[i].buf);
+	free(f->bufs);
+e3:
+	free(f->sink.stats);
+e2:
+	free(f);
+e1:
+	return NULL;
+}
+
+void sink_null_emit(sink_t *sink, int worker, int *items, int len, long support)
+{
+}
+
+void sink_null_close(sink_t *sink)
+{
+}
+
+// only counts the itemsets
+sink_t *sink_null_create(int nworkers)
+{
+	sink_t *sink = (sink_t *)malloc(sizeof(sink_t));
+	if (!sink)
+		return NULL;
+	if (sink_init(sink, nworkers))
+	{
+		free(sink);
+		return NULL;
+	}
+	sink->emit = sink_null_emit;
+	sink->close = sink_null_close;
+	return sink;
+}
@@ -0,0 +1,51 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+// receives frequent itemsets as soon as they are mined, instead of keeping them in the tree.
+// emit is called concurrently by the mining threads, each with its own worker index
+typedef struct sink
+{
+	void (*emit)(struct sink *sink, int worker, int *items, int len, long support);
+	void (*close)(struct sink *sink);
+	int nworkers;
+	struct sink_stat *stats;
+} sink_t;
+
+// per worker, padded to a cache line
+typedef struct sink_stat
+{
+	long count;
+	long len_sum;
+	char pad[48];
+} sink_stat_t;
+
+typedef struct
+{
+	char *buf;
+	size_t len;
+	char pad[48];
+} sink_buf_t;
+
+// writes itemsets as lines of space separated items followed by the support in parentheses
+typedef struct
+{
+	sink_t sink;
+	FILE *fp;
+	sink_buf_t *bufs;
+	pthread_mutex_t mutex;
+} sink_file_t;
+
+int sink_init(sink_t *sink, int nworkers);
+void sink_emit(sink_t *sink, int worker, int *items, int len, long support);
+long sink_count(sink_t *sink);
+long sink_len_sum(sink_t *sink);
+void sink_free(sink_t *sink);
+sink_t *sink_file_create(FILE *fp, int nworkers);
+void sink_file_write(sink_t *sink, int worker, const char *s, size_t len);
+char *sink_ltoa(char *end, long x);
+sink_t *sink_null_create(int nworkers);
+
+#endif
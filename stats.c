@@ -5,6 +5,7 @@
 #include <time.h>
 #include <string.h>
 #include <pthread.h>
+#include <errno.h>
 #include "stats.h"
 
 #define STAT_RAPL_MAX	10
@@ -19,9 +20,11 @@ long stat_emax[STAT_RAPL_MAX+1];
 struct timespec stat_t1, stat_t2;
 double stat_t, stat_e[STAT_RAPL_MAX+1];
 long stat_m;
+long stat_peak;
 char fin;
 pthread_t stat_collect_thread;
-pthread_mutex_t stat_collect_mutex;
+pthread_mutex_t stat_collect_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t stat_collect_cond = PTHREAD_COND_INITIALIZER;
 
 long stat_get_vsize()
 {
@@ -35,6 +38,31 @@ long stat_get_vsize()
 	return s*getpagesize();
 }
 
+// peak resident set size since the last stat_reset_peak
+long stat_get_peak()
+{
+	long s = -1;
+	char line[STAT_PATH_MAX];
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, STAT_PATH_MAX, f))
+		if (sscanf(line, "VmHWM: %ld kB", &s)==1)
+			break;
+	fclose(f);
+	return s<0? -1: s*1024;
+}
+
+// so that the peak of the measured phase is not hidden by the one of loading. needs linux 4.0
+void stat_reset_peak()
+{
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if (!f)
+		return;
+	fprintf(f, "5");
+	fclose(f);
+}
+
 long stat_get_energy(char *rapl)
 {
 	long s = -1;
@@ -98,13 +126,11 @@ int stat_init()
 	}
 	stat_t = 0.0;
 	fin = 0;
-	pthread_mutex_init(&stat_collect_mutex, NULL);
 }
 
 void stat_finish()
 {
 	int i;
-	//pthread_join(stat_collect_thread, NULL);
 	for (i=0; stat_rapl[i]!=NULL; i++)
 		free(stat_rapl_name[i]);
 }
@@ -134,19 +160,35 @@ void stat_collect()
 	pthread_mutex_unlock(&stat_collect_mutex);
 }
 
-// rapl counters overflow more often than not
+// rapl counters overflow more often than not. stat_stop wakes the thread to end it
 void *stat_periodic_collect(void *arg)
 {
-	while (!fin)
+	struct timespec t;
+	for (;;)
 	{
 		stat_collect();
-		sleep(STAT_COLLECT_INTERVAL);
+		clock_gettime(CLOCK_REALTIME, &t);
+		t.tv_sec += STAT_COLLECT_INTERVAL;
+		pthread_mutex_lock(&stat_collect_mutex);
+		while (!fin && pthread_cond_timedwait(&stat_collect_cond, &stat_collect_mutex, &t)!=ETIMEDOUT)
+			;
+		if (fin)
+			break;
+		pthread_mutex_unlock(&stat_collect_mutex);
 	}
+	pthread_mutex_unlock(&stat_collect_mutex);
+	return NULL;
 }
 
+// every start measures anew, so that one run can measure several phases
 void stat_start()
 {
 	int i;
+	stat_t = 0.0;
+	for (i=0; stat_rapl[i]!=NULL; i++)
+		stat_e[i] = 0.0;
+	fin = 0;
+	stat_reset_peak();
 	clock_gettime(CLOCK_REALTIME, &stat_t1);
 	for (i=0; stat_rapl[i]!=NULL; i++)
 		stat_e1[i] = stat_get_energy(stat_rapl[i]);
@@ -155,9 +197,14 @@ void stat_start()
 
 void stat_stop()
 {
+	pthread_mutex_lock(&stat_collect_mutex);
 	fin = 1;
+	pthread_cond_signal(&stat_collect_cond);
+	pthread_mutex_unlock(&stat_collect_mutex);
+	pthread_join(stat_collect_thread, NULL);
 	stat_collect();
 	stat_m = stat_get_vsize();
+	stat_peak = stat_get_peak();
 }
 
 void stat_head(FILE *fp)
@@ -168,6 +215,12 @@ void stat_head(FILE *fp)
 		fprintf(fp, ",energy_%s", stat_rapl_name[i]);
 }
 
+// logged after the columns of stat_log, so that those keep their positions
+long stat_peak_memory()
+{
+	return stat_peak;
+}
+
 void stat_log(FILE *fp)
 {
 	int i;
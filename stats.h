@@ -8,6 +8,7 @@ void stat_head();
 void stat_start();
 void stat_stop();
 void stat_log(FILE *f);
+long stat_peak_memory();
 void stat_finish();
 
 #endif
@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+#include "wrapper.h"
+
+// tidsets of up to this many tids are sorted arrays. below it an array is smaller than the
+// bitmap of any backend and merging two beats their container and word overhead
+#define WRAPPED_ARRAY_MAX	256
+// an array this many times longer than the other is galloped through instead of merged
+#define WRAPPED_GALLOP	32
+// results that may hold this many tids are optimized. below it optimizing costs more than
+// it saves
+#define WRAPPED_OPTIMIZE_MIN	65536
+
+const backend_t *wrapped_backends[] = {&wrapper_roaring_backend, &wrapper_bm_backend, &wrapper_ewah_backend,
+	&wrapper_concise_backend, &wrapper_dense_backend, NULL};
+
+// the backend of tidsets. the one of BITSET until another is selected
+#if BITSET == BM
+const backend_t *wrapped_backend = &wrapper_bm_backend;
+#elif BITSET == EWAH
+const backend_t *wrapped_backend = &wrapper_ewah_backend;
+#elif BITSET == CONCISE
+const backend_t *wrapped_backend = &wrapper_concise_backend;
+#elif BITSET == DENSE
+const backend_t *wrapped_backend = &wrapper_dense_backend;
+#else
+const backend_t *wrapped_backend = &wrapper_roaring_backend;
+#endif
+
+struct wrapped_bitmap
+{
+	backend_bitmap_t *bitmap; // the tids as a bitmap of the backend, or NULL for an array
+	long len; // tids. -1 for a bitmap that was not counted yet
+	uint32_t *tids; // the array, right after the struct
+};
+
+// first position from i on in x whose tid is at least t
+long wrapped_gallop(const uint32_t *x, long i, long n, uint32_t t)
+{
+	long step = 1, lo, hi;
+	while (i+step<n && x[i+step]<t)
+		step *= 2;
+	lo = i;
+	hi = i+step<n? i+step: n;
+	while (lo < hi)
+	{
+		long mid = (lo+hi)/2;
+		if (x[mid] < t)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// tids in both of the sorted arrays a and b, written to out unless it is NULL
+long wrapped_array_and(const uint32_t *a, long na, const uint32_t *b, long nb, uint32_t *out)
+{
+	long i = 0, j = 0, k = 0;
+	if (na > nb)
+		return wrapped_array_and(b, nb, a, na, out);
+	if (na*WRAPPED_GALLOP < nb)
+	{
+		for (i=0; i<na && j<nb; i++)
+		{
+			j = wrapped_gallop(b, j, nb, a[i]);
+			if (j<nb && b[j]==a[i])
+			{
+				if (out)
+					out[k] = a[i];
+				k++;
+			}
+		}
+		return k;
+	}
+#if defined(__x86_64__)
+	// blocks of 4 are compared all against all. the block with the smaller last tid moves on
+	while (i+4<=na && j+4<=nb)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b+j));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+			_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+		uint32_t amax = a[i+3], bmax = b[j+3];
+		if (!out)
+			k += __builtin_popcount(mask);
+		else
+			for (; mask; mask&=mask-1)
+				out[k++] = a[i+__builtin_ctz(mask)];
+		if (amax <= bmax)
+			i += 4;
+		if (bmax <= amax)
+			j += 4;
+	}
+#endif
+	while (i<na && j<nb)
+	{
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else
+		{
+			if (out)
+				out[k] = a[i];
+			k++;
+			i++;
+			j++;
+		}
+	}
+	return k;
+}
+
+// tids of the sorted array a that are not in the sorted array b
+long wrapped_array_andnot(const uint32_t *a, long na, const uint32_t *b, long nb, uint32_t *out)
+{
+	long i, j = 0, k = 0;
+	int gallop = na*WRAPPED_GALLOP < nb;
+	for (i=0; i<na; i++)
+	{
+		if (gallop)
+			j = wrapped_gallop(b, j, nb, a[i]);
+		else
+			while (j<nb && b[j]<a[i])
+				j++;
+		if (j==nb || b[j]!=a[i])
+			out[k++] = a[i];
+	}
+	return k;
+}
+
+wrapped_bitmap_t *wrapped_array_create(long cap)
+{
+	wrapped_bitmap_t *w = (wrapped_bitmap_t *)malloc(sizeof(wrapped_bitmap_t)+cap*sizeof(uint32_t));
+	if (!w)
+		return NULL;
+	w->bitmap = NULL;
+	w->len = 0;
+	w->tids = (uint32_t *)(w+1);
+	return w;
+}
+
+// gives an array created for the worst case back the room it did not use
+wrapped_bitmap_t *wrapped_array_fit(wrapped_bitmap_t *w)
+{
+	wrapped_bitmap_t *f = (wrapped_bitmap_t *)realloc(w, sizeof(wrapped_bitmap_t)+w->len*sizeof(uint32_t));
+	if (!f)
+		return w;
+	f->tids = (uint32_t *)(f+1);
+	return f;
+}
+
+// takes over a bitmap of the backend with at most max tids, or -1 if that is not known. a
+// small one becomes an array. counting the tids is left until they are needed when max
+// does not tell that it is small
+wrapped_bitmap_t *wrapped_bitmap_wrap(backend_bitmap_t *b, long max)
+{
+	wrapped_bitmap_t *w;
+	long card = -1;
+
+	if (!b)
+		return NULL;
+	if (max>=0 && max<=WRAPPED_ARRAY_MAX)
+		card = wrapped_backend->bitmap_get_cardinality(b);
+	if (card>=0 && card<=WRAPPED_ARRAY_MAX)
+	{
+		w = wrapped_array_create(card);
+		if (w)
+		{
+			wrapped_backend->bitmap_to_array(b, w->tids);
+			w->len = card;
+			wrapped_backend->bitmap_free(b);
+			return w;
+		}
+	}
+	w = (wrapped_bitmap_t *)malloc(sizeof(wrapped_bitmap_t));
+	if (!w)
+	{
+		wrapped_backend->bitmap_free(b);
+		return NULL;
+	}
+	w->bitmap = b;
+	w->len = card;
+	w->tids = NULL;
+	return w;
+}
+
+// a bitmap that results from an operation, with at most max tids
+wrapped_bitmap_t *wrapped_bitmap_result(backend_bitmap_t *b, long max)
+{
+	wrapped_bitmap_t *w = wrapped_bitmap_wrap(b, max);
+	if (w && max>=WRAPPED_OPTIMIZE_MIN)
+		wrapped_bitmap_optimize(w);
+	return w;
+}
+
+// the tids of w as a bitmap of the backend. one made from an array is the caller's to free
+backend_bitmap_t *wrapped_bitmap_backend_of(wrapped_bitmap_t *w)
+{
+	backend_bitmap_t *b;
+	if (w->bitmap)
+		return w->bitmap;
+	b = wrapped_backend->bitmap_create();
+	if (b)
+		wrapped_backend->bitmap_add_many(b, w->tids, w->len);
+	return b;
+}
+
+// arrays are only made by operations and do not grow. one that is added to becomes a bitmap
+void wrapped_bitmap_unpack(wrapped_bitmap_t *w)
+{
+	if (w->bitmap)
+		return;
+	w->bitmap = wrapped_bitmap_backend_of(w);
+	w->tids = NULL;
+}
+
+// a new tidset is added to, so it stays a bitmap
+wrapped_bitmap_t *wrapped_bitmap_create()
+{
+	return wrapped_bitmap_wrap(wrapped_backend->bitmap_create(), -1);
+}
+
+void wrapped_bitmap_free(wrapped_bitmap_t *a)
+{
+	if (a->bitmap)
+		wrapped_backend->bitmap_free(a->bitmap);
+	free(a);
+}
+
+void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x)
+{
+	wrapped_bitmap_unpack(a);
+	wrapped_backend->bitmap_add(a->bitmap, x);
+	a->len = -1;
+}
+
+void wrapped_bitmap_add_many(wrapped_bitmap_t *a, const uint32_t *x, long n)
+{
+	wrapped_bitmap_unpack(a);
+	wrapped_backend->bitmap_add_many(a->bitmap, x, n);
+	a->len = -1;
+}
+
+wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+{
+	wrapped_bitmap_t *r;
+
+	if (a->bitmap && b->bitmap)
+	{
+		long na = wrapped_bitmap_get_cardinality(a), nb = wrapped_bitmap_get_cardinality(b);
+		return wrapped_bitmap_result(wrapped_backend->bitmap_and(a->bitmap, b->bitmap), na<nb? na: nb);
+	}
+	// the result is no longer than an array operand
+	if (a->bitmap)
+		return wrapped_bitmap_and(b, a);
+	r = wrapped_array_create(b->bitmap || a->len<b->len? a->len: b->len);
+	if (!r)
+		return NULL;
+	if (b->bitmap)
+		r->len = wrapped_backend->bitmap_and_array(b->bitmap, a->tids, a->len, r->tids);
+	else
+		r->len = wrapped_array_and(a->tids, a->len, b->tids, b->len, r->tids);
+	return wrapped_array_fit(r);
+}
+
+long wrapped_bitmap_and_cardinality(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+{
+	if (a->bitmap && b->bitmap)
+		return wrapped_backend->bitmap_and_cardinality(a->bitmap, b->bitmap);
+	if (a->bitmap)
+		return wrapped_backend->bitmap_and_array(a->bitmap, b->tids, b->len, NULL);
+	if (b->bitmap)
+		return wrapped_backend->bitmap_and_array(b->bitmap, a->tids, a->len, NULL);
+	return wrapped_array_and(a->tids, a->len, b->tids, b->len, NULL);
+}
+
+wrapped_bitmap_t *wrapped_bitmap_andnot(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+{
+	wrapped_bitmap_t *r;
+	backend_bitmap_t *t;
+	uint32_t *both;
+	long n;
+
+	if (a->bitmap)
+	{
+		t = wrapped_bitmap_backend_of(b);
+		if (!t)
+			return NULL;
+		r = wrapped_bitmap_result(wrapped_backend->bitmap_andnot(a->bitmap, t), wrapped_bitmap_get_cardinality(a));
+		if (t != b->bitmap)
+			wrapped_backend->bitmap_free(t);
+		return r;
+	}
+	r = wrapped_array_create(a->len);
+	if (!r)
+		return NULL;
+	if (!b->bitmap)
+		r->len = wrapped_array_andnot(a->tids, a->len, b->tids, b->len, r->tids);
+	else
+	{
+		// the tids of a that are in the bitmap are taken out
+		both = (uint32_t *)malloc(a->len*sizeof(uint32_t)+1);
+		if (!both)
+		{
+			free(r);
+			return NULL;
+		}
+		n = wrapped_backend->bitmap_and_array(b->bitmap, a->tids, a->len, both);
+		r->len = wrapped_array_andnot(a->tids, a->len, both, n, r->tids);
+		free(both);
+	}
+	return wrapped_array_fit(r);
+}
+
+long wrapped_bitmap_andnot_cardinality(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+{
+	if (a->bitmap && b->bitmap)
+		return wrapped_backend->bitmap_andnot_cardinality(a->bitmap, b->bitmap);
+	return wrapped_bitmap_get_cardinality(a)-wrapped_bitmap_and_cardinality(a, b);
+}
+
+void wrapped_bitmap_or_inplace(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+{
+	backend_bitmap_t *t;
+	wrapped_bitmap_unpack(a);
+	t = wrapped_bitmap_backend_of(b);
+	if (!t)
+		return;
+	wrapped_backend->bitmap_or_inplace(a->bitmap, t);
+	a->len = -1;
+	if (t != b->bitmap)
+		wrapped_backend->bitmap_free(t);
+}
+
+// a bitmap is counted once. threads sharing a tidset may count it together and store the same
+long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a)
+{
+	long len = __atomic_load_n(&a->len, __ATOMIC_RELAXED);
+	if (len < 0)
+	{
+		len = wrapped_backend->bitmap_get_cardinality(a->bitmap);
+		__atomic_store_n(&a->len, len, __ATOMIC_RELAXED);
+	}
+	return len;
+}
+
+void wrapped_bitmap_to_array(wrapped_bitmap_t *a, uint32_t *out)
+{
+	if (a->bitmap)
+		wrapped_backend->bitmap_to_array(a->bitmap, out);
+	else
+		memcpy(out, a->tids, a->len*sizeof(uint32_t));
+}
+
+// arrays are made to fit already
+long wrapped_bitmap_optimize(wrapped_bitmap_t *a)
+{
+	return a->bitmap? wrapped_backend->bitmap_optimize(a->bitmap): 0;
+}
+
+const char *wrapped_bitmap_backend()
+{
+	return wrapped_backend->name;
+}
+
+int wrapped_bitmap_select(const char *name)
+{
+	int i;
+	for (i=0; wrapped_backends[i]; i++)
+		if (strcmp(wrapped_backends[i]->name, name) == 0)
+		{
+			wrapped_backend = wrapped_backends[i];
+			return 0;
+		}
+	return -1;
+}
+
+// arrays are saved as bitmaps of the backend, so saved tidsets do not depend on the form
+size_t wrapped_bitmap_serialize_size(wrapped_bitmap_t *a)
+{
+	size_t size;
+	backend_bitmap_t *t = wrapped_bitmap_backend_of(a);
+	if (!t)
+		return 0;
+	size = wrapped_backend->bitmap_serialize_size(t);
+	if (t != a->bitmap)
+		wrapped_backend->bitmap_free(t);
+	return size;
+}
+
+size_t wrapped_bitmap_serialize(wrapped_bitmap_t *a, char *buf)
+{
+	size_t size;
+	backend_bitmap_t *t = wrapped_bitmap_backend_of(a);
+	if (!t)
+		return 0;
+	size = wrapped_backend->bitmap_serialize(t, buf);
+	if (t != a->bitmap)
+		wrapped_backend->bitmap_free(t);
+	return size;
+}
+
+wrapped_bitmap_t *wrapped_bitmap_deserialize(const char *buf, size_t len)
+{
+	return wrapped_bitmap_wrap(wrapped_backend->bitmap_deserialize(buf, len), -1);
+}
+
+const char *wrapped_bitmap_backend_at(int i)
+{
+	int n;
+	for (n=0; wrapped_backends[n]; n++)
+		;
+	return i>=0 && i<n? wrapped_backends[i]->name: NULL;
+}
+
+// the named backend is selected while the copy is built. not for use while others make tidsets
+wrapped_bitmap_t *wrapped_bitmap_move(wrapped_bitmap_t *a, const char *name)
+{
+	const backend_t *from = wrapped_backend;
+	wrapped_bitmap_t *r = NULL;
+	long n = wrapped_bitmap_get_cardinality(a);
+	uint32_t *tids = (uint32_t *)malloc(n*sizeof(uint32_t)+1);
+
+	if (!tids)
+		return NULL;
+	wrapped_bitmap_to_array(a, tids);
+	if (wrapped_bitmap_select(name) == 0)
+	{
+		r = wrapped_bitmap_create();
+		if (r)
+			wrapped_bitmap_add_many(r, tids, n);
+		wrapped_backend = from;
+	}
+	free(tids);
+	if (r)
+		wrapped_bitmap_free(a);
+	return r;
+}
@@ -6,28 +6,78 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define ROARING	1
 #define EWAH	2
 #define BM		3
 #define CONCISE	4
+#define DENSE	5
 
 
-#if BITSET==ROARING
-#include "roaring.h"
-typedef roaring_bitmap_t wrapped_bitmap_t;
-#else
-typedef void wrapped_bitmap_t;
-#endif
+// a tidset. small ones are sorted arrays, the others bitmaps of the backend
+typedef struct wrapped_bitmap wrapped_bitmap_t;
 
 wrapped_bitmap_t *wrapped_bitmap_create();
 void wrapped_bitmap_free(wrapped_bitmap_t *a);
 void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x);
+void wrapped_bitmap_add_many(wrapped_bitmap_t *a, const uint32_t *x, long n);
 wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b);
+long wrapped_bitmap_and_cardinality(wrapped_bitmap_t *a, wrapped_bitmap_t *b);
+wrapped_bitmap_t *wrapped_bitmap_andnot(wrapped_bitmap_t *a, wrapped_bitmap_t *b);
+long wrapped_bitmap_andnot_cardinality(wrapped_bitmap_t *a, wrapped_bitmap_t *b);
+void wrapped_bitmap_or_inplace(wrapped_bitmap_t *a, wrapped_bitmap_t *b);
 long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a);
+// writes the tids in ascending order
+void wrapped_bitmap_to_array(wrapped_bitmap_t *a, uint32_t *out);
+long wrapped_bitmap_optimize(wrapped_bitmap_t *a);
+const char *wrapped_bitmap_backend();
+// makes the named backend the one of tidsets created from now on. tidsets of the previous
+// one must all be freed before. returns -1 for an unknown name
+int wrapped_bitmap_select(const char *name);
+// name of the i-th backend linked in. NULL past the last one
+const char *wrapped_bitmap_backend_at(int i);
+// rebuilds a tidset of the current backend with the named one and frees it. NULL on failure,
+// leaving a as it is. the current backend stays selected
+wrapped_bitmap_t *wrapped_bitmap_move(wrapped_bitmap_t *a, const char *name);
+size_t wrapped_bitmap_serialize_size(wrapped_bitmap_t *a);
+size_t wrapped_bitmap_serialize(wrapped_bitmap_t *a, char *buf);
+wrapped_bitmap_t *wrapped_bitmap_deserialize(const char *buf, size_t len);
+
+// the bitmaps of a backend. every wrapper_<backend> file fills a table of its functions
+typedef void backend_bitmap_t;
+
+typedef struct
+{
+	const char *name;
+	backend_bitmap_t *(*bitmap_create)();
+	void (*bitmap_free)(backend_bitmap_t *a);
+	void (*bitmap_add)(backend_bitmap_t *a, uint32_t x);
+	void (*bitmap_add_many)(backend_bitmap_t *a, const uint32_t *x, long n);
+	backend_bitmap_t *(*bitmap_and)(backend_bitmap_t *a, backend_bitmap_t *b);
+	long (*bitmap_and_cardinality)(backend_bitmap_t *a, backend_bitmap_t *b);
+	backend_bitmap_t *(*bitmap_andnot)(backend_bitmap_t *a, backend_bitmap_t *b);
+	long (*bitmap_andnot_cardinality)(backend_bitmap_t *a, backend_bitmap_t *b);
+	void (*bitmap_or_inplace)(backend_bitmap_t *a, backend_bitmap_t *b);
+	long (*bitmap_get_cardinality)(backend_bitmap_t *a);
+	// the n sorted tids of x that are in a. they are written to out unless it is NULL
+	long (*bitmap_and_array)(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out);
+	void (*bitmap_to_array)(backend_bitmap_t *a, uint32_t *out);
+	// compresses a as far as the backend can and gives back unused room. returns bytes saved
+	long (*bitmap_optimize)(backend_bitmap_t *a);
+	size_t (*bitmap_serialize_size)(backend_bitmap_t *a);
+	size_t (*bitmap_serialize)(backend_bitmap_t *a, char *buf);
+	backend_bitmap_t *(*bitmap_deserialize)(const char *buf, size_t len);
+} backend_t;
+
+extern const backend_t wrapper_roaring_backend;
+extern const backend_t wrapper_bm_backend;
+extern const backend_t wrapper_ewah_backend;
+extern const backend_t wrapper_concise_backend;
+extern const backend_t wrapper_dense_backend;
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -1,31 +1,170 @@
+#include <stdexcept>
 #include "wrapper.h"
 #include "bm.h"
+#include "bmalgo.h"
+#include "bmserial.h"
 
 typedef bm::bvector<> bitmap;
 
-wrapped_bitmap_t *wrapped_bitmap_create()
+backend_bitmap_t *wrapper_bm_create()
 {
 	return reinterpret_cast<void*>(new bitmap);	
 }
 
-void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x)
+void wrapper_bm_add(backend_bitmap_t *a, uint32_t x)
 {
 	reinterpret_cast<bitmap*>(a)->set(x);
 }
 
-void wrapped_bitmap_free(wrapped_bitmap_t *a)
+// x is ascending, which lets bitmagic fill one block after another
+void wrapper_bm_add_many(backend_bitmap_t *a, const uint32_t *x, long n)
+{
+	reinterpret_cast<bitmap*>(a)->set(x, n, bm::BM_SORTED);
+}
+
+void wrapper_bm_free(backend_bitmap_t *a)
 {
 	delete reinterpret_cast<bitmap*>(a);	
 }
 
-wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+backend_bitmap_t *wrapper_bm_and(backend_bitmap_t *a, backend_bitmap_t *b)
 {
 	bitmap *c = new bitmap(*(reinterpret_cast<bitmap*>(a)));
 	c->bit_and(*(reinterpret_cast<bitmap*>(b)));
 	return c;
 }
 
-long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a)
+long wrapper_bm_and_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return bm::count_and(*(reinterpret_cast<bitmap*>(a)), *(reinterpret_cast<bitmap*>(b)));
+}
+
+backend_bitmap_t *wrapper_bm_andnot(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	bitmap *c = new bitmap(*(reinterpret_cast<bitmap*>(a)));
+	c->bit_sub(*(reinterpret_cast<bitmap*>(b)));
+	return c;
+}
+
+long wrapper_bm_andnot_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return bm::count_sub(*(reinterpret_cast<bitmap*>(a)), *(reinterpret_cast<bitmap*>(b)));
+}
+
+void wrapper_bm_or_inplace(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	reinterpret_cast<bitmap*>(a)->bit_or(*(reinterpret_cast<bitmap*>(b)));
+}
+
+long wrapper_bm_get_cardinality(backend_bitmap_t *a)
 {
 	return reinterpret_cast<bitmap*>(a)->count();	
 }
+
+long wrapper_bm_and_array(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	long k = 0;
+	for (long i=0; i<n; i++)
+		if (b->test(x[i]))
+		{
+			if (out)
+				out[k] = x[i];
+			k++;
+		}
+	return k;
+}
+
+void wrapper_bm_to_array(backend_bitmap_t *a, uint32_t *out)
+{
+	for (bitmap::enumerator e=reinterpret_cast<bitmap*>(a)->first(); e.valid(); ++e)
+		*out++ = *e;
+}
+
+// blocks become gap encoded where that is smaller and empty or full ones are freed
+long wrapper_bm_optimize(backend_bitmap_t *a)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	bitmap::statistics st;
+	long size;
+	b->calc_stat(&st);
+	size = st.memory_used;
+	b->optimize(0, bitmap::opt_compress);
+	b->calc_stat(&st);
+	return size-(long)st.memory_used;
+}
+
+size_t wrapper_bm_serialize_size(backend_bitmap_t *a)
+{
+	bitmap::statistics st;
+	reinterpret_cast<bitmap*>(a)->calc_stat(&st);
+	return st.max_serialize_mem;
+}
+
+size_t wrapper_bm_serialize(backend_bitmap_t *a, char *buf)
+{
+	return bm::serialize(*(reinterpret_cast<bitmap*>(a)), reinterpret_cast<unsigned char*>(buf));
+}
+
+// the deserializer of this bitmagic only takes the start of a buffer. its decoder is a template
+// argument though, so this one checks every read against the end and throws past it
+class wrapper_bm_decoder : public bm::decoder
+{
+public:
+	static thread_local const unsigned char *end;
+	wrapper_bm_decoder(const unsigned char *buf) : bm::decoder(buf) {}
+	void check(size_t n) { if (n > size_t(end-get_pos())) throw std::out_of_range("bm stream"); }
+	unsigned char get_8() { check(1); return bm::decoder::get_8(); }
+	bm::short_t get_16() { check(2); return bm::decoder::get_16(); }
+	bm::word_t get_32() { check(4); return bm::decoder::get_32(); }
+	bm::id64_t get_64() { check(8); return bm::decoder::get_64(); }
+	void get_16(bm::short_t *s, unsigned n) { check(n*2ul); bm::decoder::get_16(s, n); }
+	void get_32(bm::word_t *w, unsigned n) { check(n*4ul); bm::decoder::get_32(w, n); }
+	bool get_32_OR(bm::word_t *w, unsigned n) { check(n*4ul); return bm::decoder::get_32_OR(w, n); }
+	void get_32_AND(bm::word_t *w, unsigned n) { check(n*4ul); bm::decoder::get_32_AND(w, n); }
+	void memcpy(unsigned char *dst, size_t n) { check(n); bm::decoder::memcpy(dst, n); }
+	void seek(int delta) { if (delta > 0) check(delta); bm::decoder::seek(delta); }
+};
+
+thread_local const unsigned char *wrapper_bm_decoder::end;
+
+// the buffer comes from the same machine, so it is in native byte order
+backend_bitmap_t *wrapper_bm_deserialize(const char *buf, size_t len)
+{
+	bitmap *c = NULL;
+	bm::deserializer<bitmap, wrapper_bm_decoder> d;
+	wrapper_bm_decoder::end = reinterpret_cast<const unsigned char*>(buf)+len;
+	// no exception may leave for the c callers
+	try
+	{
+		c = new bitmap;
+		d.deserialize(*c, reinterpret_cast<const unsigned char*>(buf), 0);
+	}
+	catch (const std::exception &)
+	{
+		delete c;
+		return NULL;
+	}
+	return c;
+}
+
+const backend_t wrapper_bm_backend =
+{
+	"bm",
+	wrapper_bm_create,
+	wrapper_bm_free,
+	wrapper_bm_add,
+	wrapper_bm_add_many,
+	wrapper_bm_and,
+	wrapper_bm_and_cardinality,
+	wrapper_bm_andnot,
+	wrapper_bm_andnot_cardinality,
+	wrapper_bm_or_inplace,
+	wrapper_bm_get_cardinality,
+	wrapper_bm_and_array,
+	wrapper_bm_to_array,
+	wrapper_bm_optimize,
+	wrapper_bm_serialize_size,
+	wrapper_bm_serialize,
+	wrapper_bm_deserialize
+};
@@ -1,32 +1,151 @@
 #include <cassert>
+#include <cstring>
 #include "wrapper.h"
 #include "concise.h"
 
 typedef ConciseSet<false> bitmap;
 
-wrapped_bitmap_t *wrapped_bitmap_create()
+backend_bitmap_t *wrapper_concise_create()
 {
 	return reinterpret_cast<void*>(new bitmap);	
 }
 
-void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x)
+void wrapper_concise_add(backend_bitmap_t *a, uint32_t x)
 {
 	reinterpret_cast<bitmap*>(a)->add(x);
 }
 
-void wrapped_bitmap_free(wrapped_bitmap_t *a)
+// x is ascending. concise only appends, so this is as fast as it gets
+void wrapper_concise_add_many(backend_bitmap_t *a, const uint32_t *x, long n)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	for (long i=0; i<n; i++)
+		b->add(x[i]);
+}
+
+void wrapper_concise_free(backend_bitmap_t *a)
 {
 	delete reinterpret_cast<bitmap*>(a);	
 }
 
-wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+backend_bitmap_t *wrapper_concise_and(backend_bitmap_t *a, backend_bitmap_t *b)
 {
 	bitmap *c = new bitmap;
 	reinterpret_cast<bitmap*>(a)->logicalandToContainer(*(reinterpret_cast<bitmap*>(b)), *c);
 	return c;
 }
 
-long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a)
+long wrapper_concise_and_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return reinterpret_cast<bitmap*>(a)->logicalandCount(*(reinterpret_cast<bitmap*>(b)));
+}
+
+backend_bitmap_t *wrapper_concise_andnot(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	bitmap *c = new bitmap;
+	reinterpret_cast<bitmap*>(a)->logicalandnotToContainer(*(reinterpret_cast<bitmap*>(b)), *c);
+	return c;
+}
+
+long wrapper_concise_andnot_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return reinterpret_cast<bitmap*>(a)->logicalandnotCount(*(reinterpret_cast<bitmap*>(b)));
+}
+
+void wrapper_concise_or_inplace(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	bitmap c;
+	reinterpret_cast<bitmap*>(a)->logicalorToContainer(*(reinterpret_cast<bitmap*>(b)), c);
+	*reinterpret_cast<bitmap*>(a) = c;
+}
+
+long wrapper_concise_get_cardinality(backend_bitmap_t *a)
 {
 	return reinterpret_cast<bitmap*>(a)->size();	
 }
+
+// concise has no random access. x becomes a bitmap of its own
+long wrapper_concise_and_array(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out)
+{
+	bitmap b, c;
+	long k = 0;
+	for (long i=0; i<n; i++)
+		b.add(x[i]);
+	if (!out)
+		return reinterpret_cast<bitmap*>(a)->logicalandCount(b);
+	reinterpret_cast<bitmap*>(a)->logicalandToContainer(b, c);
+	for (bitmap::const_iterator i=c.begin(); i!=c.end(); ++i)
+		out[k++] = *i;
+	return k;
+}
+
+void wrapper_concise_to_array(backend_bitmap_t *a, uint32_t *out)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	for (bitmap::const_iterator i=b->begin(); i!=b->end(); ++i)
+		*out++ = *i;
+}
+
+// concise is compressed as it is built. only the room the words do not use is given back
+long wrapper_concise_optimize(backend_bitmap_t *a)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	long size = b->words.capacity();
+	b->shrink_to_fit();
+	return (size-(long)b->words.capacity())*sizeof(uint32_t);
+}
+
+// concise has no serializer. the words are dumped after the last bit and word index
+size_t wrapper_concise_serialize_size(backend_bitmap_t *a)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	return (b->lastWordIndex+3)*sizeof(uint32_t);
+}
+
+size_t wrapper_concise_serialize(backend_bitmap_t *a, char *buf)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	memcpy(buf, &b->last, sizeof(int32_t));
+	memcpy(buf+sizeof(int32_t), &b->lastWordIndex, sizeof(int32_t));
+	memcpy(buf+2*sizeof(int32_t), b->words.data(), (b->lastWordIndex+1)*sizeof(uint32_t));
+	return wrapper_concise_serialize_size(a);
+}
+
+backend_bitmap_t *wrapper_concise_deserialize(const char *buf, size_t len)
+{
+	bitmap *c = new bitmap;
+	if (len < 2*sizeof(int32_t))
+		goto e1;
+	memcpy(&c->last, buf, sizeof(int32_t));
+	memcpy(&c->lastWordIndex, buf+sizeof(int32_t), sizeof(int32_t));
+	if (c->lastWordIndex<-1 || len < wrapper_concise_serialize_size(c))
+		goto e1;
+	c->words.resize(c->lastWordIndex+1);
+	memcpy(c->words.data(), buf+2*sizeof(int32_t), (c->lastWordIndex+1)*sizeof(uint32_t));
+	return c;
+
+e1:
+	delete c;
+	return NULL;
+}
+
+const backend_t wrapper_concise_backend =
+{
+	"concise",
+	wrapper_concise_create,
+	wrapper_concise_free,
+	wrapper_concise_add,
+	wrapper_concise_add_many,
+	wrapper_concise_and,
+	wrapper_concise_and_cardinality,
+	wrapper_concise_andnot,
+	wrapper_concise_andnot_cardinality,
+	wrapper_concise_or_inplace,
+	wrapper_concise_get_cardinality,
+	wrapper_concise_and_array,
+	wrapper_concise_to_array,
+	wrapper_concise_optimize,
+	wrapper_concise_serialize_size,
+	wrapper_concise_serialize,
+	wrapper_concise_deserialize
+};
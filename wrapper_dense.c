@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "wrapper.h"
+
+// words are aligned for the widest vectors, so that vectors over whole bitmaps do not
+// straddle cache lines
+#define DENSE_ALIGN	64
+#define DENSE_INIT	8
+
+// an uncompressed bitmap. word i holds tids 64*i to 64*i+63
+typedef struct
+{
+	uint64_t *words;
+	long len; // words in use. the ones after the last nonzero word are dropped
+	long cap;
+	long card; // tids, or -1 when not known
+} dense_bitmap_t;
+
+// out = a op b over n words, or just counted when out is NULL. returns the tids of the result
+typedef long (*dense_kernel_t)(const uint64_t *a, const uint64_t *b, uint64_t *out, long n);
+
+dense_kernel_t dense_and;
+dense_kernel_t dense_andnot;
+
+long dense_and_scalar(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i, k = 0;
+	for (i=0; i<n; i++)
+	{
+		uint64_t w = a[i]&b[i];
+		if (out)
+			out[i] = w;
+		k += __builtin_popcountll(w);
+	}
+	return k;
+}
+
+long dense_andnot_scalar(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i, k = 0;
+	for (i=0; i<n; i++)
+	{
+		uint64_t w = a[i]&~b[i];
+		if (out)
+			out[i] = w;
+		k += __builtin_popcountll(w);
+	}
+	return k;
+}
+
+#if defined(__x86_64__)
+// bits of every byte are counted a nibble at a time by table lookup and summed per word
+__attribute__((target("avx2")))
+__m256i dense_popcount_avx2(__m256i v)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+	__m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+long dense_sum_avx2(__m256i s)
+{
+	return _mm256_extract_epi64(s, 0)+_mm256_extract_epi64(s, 1)+_mm256_extract_epi64(s, 2)+_mm256_extract_epi64(s, 3);
+}
+
+__attribute__((target("avx2")))
+long dense_and_avx2(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i;
+	__m256i s = _mm256_setzero_si256();
+	for (i=0; i+4<=n; i+=4)
+	{
+		__m256i w = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a+i)), _mm256_loadu_si256((const __m256i *)(b+i)));
+		if (out)
+			_mm256_storeu_si256((__m256i *)(out+i), w);
+		s = _mm256_add_epi64(s, dense_popcount_avx2(w));
+	}
+	return dense_sum_avx2(s)+dense_and_scalar(a+i, b+i, out? out+i: NULL, n-i);
+}
+
+__attribute__((target("avx2")))
+long dense_andnot_avx2(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i;
+	__m256i s = _mm256_setzero_si256();
+	for (i=0; i+4<=n; i+=4)
+	{
+		__m256i w = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)(b+i)), _mm256_loadu_si256((const __m256i *)(a+i)));
+		if (out)
+			_mm256_storeu_si256((__m256i *)(out+i), w);
+		s = _mm256_add_epi64(s, dense_popcount_avx2(w));
+	}
+	return dense_sum_avx2(s)+dense_andnot_scalar(a+i, b+i, out? out+i: NULL, n-i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+long dense_and_avx512(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i;
+	__m512i s = _mm512_setzero_si512();
+	for (i=0; i+8<=n; i+=8)
+	{
+		__m512i w = _mm512_and_si512(_mm512_loadu_si512(a+i), _mm512_loadu_si512(b+i));
+		if (out)
+			_mm512_storeu_si512(out+i, w);
+		s = _mm512_add_epi64(s, _mm512_popcnt_epi64(w));
+	}
+	return _mm512_reduce_add_epi64(s)+dense_and_scalar(a+i, b+i, out? out+i: NULL, n-i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+long dense_andnot_avx512(const uint64_t *a, const uint64_t *b, uint64_t *out, long n)
+{
+	long i;
+	__m512i s = _mm512_setzero_si512();
+	for (i=0; i+8<=n; i+=8)
+	{
+		__m512i w = _mm512_andnot_si512(_mm512_loadu_si512(b+i), _mm512_loadu_si512(a+i));
+		if (out)
+			_mm512_storeu_si512(out+i, w);
+		s = _mm512_add_epi64(s, _mm512_popcnt_epi64(w));
+	}
+	return _mm512_reduce_add_epi64(s)+dense_andnot_scalar(a+i, b+i, out? out+i: NULL, n-i);
+}
+#endif
+
+// kernels are picked for the cpu once, before main
+__attribute__((constructor))
+void dense_select()
+{
+	dense_and = dense_and_scalar;
+	dense_andnot = dense_andnot_scalar;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+	{
+		dense_and = dense_and_avx512;
+		dense_andnot = dense_andnot_avx512;
+	}
+	else if (__builtin_cpu_supports("avx2"))
+	{
+		dense_and = dense_and_avx2;
+		dense_andnot = dense_andnot_avx2;
+	}
+#endif
+}
+
+dense_bitmap_t *dense_bitmap_create(long cap)
+{
+	dense_bitmap_t *a = (dense_bitmap_t *)malloc(sizeof(dense_bitmap_t));
+	if (!a)
+		goto e1;
+	a->cap = cap>0? cap: 1;
+	if (posix_memalign((void **)&a->words, DENSE_ALIGN, a->cap*sizeof(uint64_t)))
+		goto e2;
+	a->len = 0;
+	a->card = 0;
+	return a;
+
+e2:
+	free(a);
+e1:
+	return NULL;
+}
+
+// makes room for len words. new words are zero. a bitmap that can not grow is fatal,
+// as dropping tids would silently change the result
+void dense_bitmap_grow(dense_bitmap_t *a, long len)
+{
+	uint64_t *words;
+	long cap;
+
+	if (len <= a->len)
+		return;
+	if (len > a->cap)
+	{
+		cap = 2*a->cap>len? 2*a->cap: len;
+		if (posix_memalign((void **)&words, DENSE_ALIGN, cap*sizeof(uint64_t)))
+		{
+			fprintf(stderr, "out of memory for a dense bitmap of %ld words\n", cap);
+			exit(1);
+		}
+		memcpy(words, a->words, a->len*sizeof(uint64_t));
+		free(a->words);
+		a->words = words;
+		a->cap = cap;
+	}
+	memset(a->words+a->len, 0, (len-a->len)*sizeof(uint64_t));
+	a->len = len;
+}
+
+// drops the zero words at the end of a result
+void dense_bitmap_trim(dense_bitmap_t *a)
+{
+	while (a->len>0 && !a->words[a->len-1])
+		a->len--;
+}
+
+backend_bitmap_t *wrapper_dense_create()
+{
+	return dense_bitmap_create(DENSE_INIT);
+}
+
+void wrapper_dense_free(backend_bitmap_t *a)
+{
+	free(((dense_bitmap_t *)a)->words);
+	free(a);
+}
+
+void wrapper_dense_add(backend_bitmap_t *a, uint32_t x)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	dense_bitmap_grow(d, x/64+1);
+	d->words[x/64] |= 1ULL<<x%64;
+	d->card = -1;
+}
+
+// x is ascending, so its last tid sizes the bitmap
+void wrapper_dense_add_many(backend_bitmap_t *a, const uint32_t *x, long n)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	long i;
+	if (n <= 0)
+		return;
+	dense_bitmap_grow(d, x[n-1]/64+1);
+	for (i=0; i<n; i++)
+		d->words[x[i]/64] |= 1ULL<<x[i]%64;
+	d->card = -1;
+}
+
+// the and is counted while it is written, which saves counting the result later
+backend_bitmap_t *wrapper_dense_and(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	dense_bitmap_t *x = (dense_bitmap_t *)a, *y = (dense_bitmap_t *)b, *c;
+	long n = x->len<y->len? x->len: y->len;
+	c = dense_bitmap_create(n);
+	if (!c)
+		return NULL;
+	c->card = dense_and(x->words, y->words, c->words, n);
+	c->len = n;
+	dense_bitmap_trim(c);
+	return c;
+}
+
+long wrapper_dense_and_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	dense_bitmap_t *x = (dense_bitmap_t *)a, *y = (dense_bitmap_t *)b;
+	return dense_and(x->words, y->words, NULL, x->len<y->len? x->len: y->len);
+}
+
+backend_bitmap_t *wrapper_dense_andnot(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	dense_bitmap_t *x = (dense_bitmap_t *)a, *y = (dense_bitmap_t *)b, *c;
+	long n = x->len<y->len? x->len: y->len;
+	c = dense_bitmap_create(x->len);
+	if (!c)
+		return NULL;
+	c->card = dense_andnot(x->words, y->words, c->words, n);
+	// words of a past the end of b are kept as they are
+	memcpy(c->words+n, x->words+n, (x->len-n)*sizeof(uint64_t));
+	c->card += dense_and(x->words+n, x->words+n, NULL, x->len-n);
+	c->len = x->len;
+	dense_bitmap_trim(c);
+	return c;
+}
+
+long wrapper_dense_andnot_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	dense_bitmap_t *x = (dense_bitmap_t *)a, *y = (dense_bitmap_t *)b;
+	long n = x->len<y->len? x->len: y->len;
+	return dense_andnot(x->words, y->words, NULL, n)+dense_and(x->words+n, x->words+n, NULL, x->len-n);
+}
+
+void wrapper_dense_or_inplace(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	dense_bitmap_t *x = (dense_bitmap_t *)a, *y = (dense_bitmap_t *)b;
+	long i;
+	dense_bitmap_grow(x, y->len);
+	for (i=0; i<y->len; i++)
+		x->words[i] |= y->words[i];
+	x->card = -1;
+}
+
+// a with itself is a plain count
+long wrapper_dense_get_cardinality(backend_bitmap_t *a)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	if (d->card >= 0)
+		return d->card;
+	return dense_and(d->words, d->words, NULL, d->len);
+}
+
+long wrapper_dense_and_array(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	long i, k = 0;
+	for (i=0; i<n; i++)
+		if (x[i]/64<d->len && (d->words[x[i]/64]>>x[i]%64&1))
+		{
+			if (out)
+				out[k] = x[i];
+			k++;
+		}
+	return k;
+}
+
+void wrapper_dense_to_array(backend_bitmap_t *a, uint32_t *out)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	long i, k = 0;
+	uint64_t w;
+	for (i=0; i<d->len; i++)
+		for (w=d->words[i]; w; w&=w-1)
+			out[k++] = (uint32_t)(i*64+__builtin_ctzll(w));
+}
+
+// words are never compressed. the room past the last nonzero word is given back
+long wrapper_dense_optimize(backend_bitmap_t *a)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	uint64_t *words;
+	long cap, size = d->cap;
+
+	dense_bitmap_trim(d);
+	cap = d->len>0? d->len: 1;
+	if (cap==d->cap || posix_memalign((void **)&words, DENSE_ALIGN, cap*sizeof(uint64_t)))
+		return 0;
+	memcpy(words, d->words, d->len*sizeof(uint64_t));
+	free(d->words);
+	d->words = words;
+	d->cap = cap;
+	return (size-cap)*sizeof(uint64_t);
+}
+
+// the number of words followed by the words, in host byte order
+size_t wrapper_dense_serialize_size(backend_bitmap_t *a)
+{
+	return sizeof(uint64_t)+((dense_bitmap_t *)a)->len*sizeof(uint64_t);
+}
+
+size_t wrapper_dense_serialize(backend_bitmap_t *a, char *buf)
+{
+	dense_bitmap_t *d = (dense_bitmap_t *)a;
+	uint64_t len = d->len;
+	memcpy(buf, &len, sizeof(len));
+	memcpy(buf+sizeof(len), d->words, d->len*sizeof(uint64_t));
+	return wrapper_dense_serialize_size(a);
+}
+
+backend_bitmap_t *wrapper_dense_deserialize(const char *buf, size_t len)
+{
+	dense_bitmap_t *d;
+	uint64_t n;
+	if (len < sizeof(n))
+		return NULL;
+	memcpy(&n, buf, sizeof(n));
+	if (n > (len-sizeof(n))/sizeof(uint64_t))
+		return NULL;
+	d = dense_bitmap_create(n);
+	if (!d)
+		return NULL;
+	memcpy(d->words, buf+sizeof(n), n*sizeof(uint64_t));
+	d->len = n;
+	d->card = -1;
+	return d;
+}
+
+const backend_t wrapper_dense_backend =
+{
+	"dense",
+	wrapper_dense_create,
+	wrapper_dense_free,
+	wrapper_dense_add,
+	wrapper_dense_add_many,
+	wrapper_dense_and,
+	wrapper_dense_and_cardinality,
+	wrapper_dense_andnot,
+	wrapper_dense_andnot_cardinality,
+	wrapper_dense_or_inplace,
+	wrapper_dense_get_cardinality,
+	wrapper_dense_and_array,
+	wrapper_dense_to_array,
+	wrapper_dense_optimize,
+	wrapper_dense_serialize_size,
+	wrapper_dense_serialize,
+	wrapper_dense_deserialize
+};
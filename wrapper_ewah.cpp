@@ -1,31 +1,161 @@
+#include <string.h>
+#include <stdexcept>
 #include "wrapper.h"
 #include "ewah.h"
 
 typedef EWAHBoolArray<uint64_t> bitmap;
 
-wrapped_bitmap_t *wrapped_bitmap_create()
+backend_bitmap_t *wrapper_ewah_create()
 {
 	return reinterpret_cast<void*>(new bitmap);	
 }
 
-void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x)
+void wrapper_ewah_add(backend_bitmap_t *a, uint32_t x)
 {
 	reinterpret_cast<bitmap*>(a)->set(x);
 }
 
-void wrapped_bitmap_free(wrapped_bitmap_t *a)
+// x is ascending. ewah only appends, so this is as fast as it gets
+void wrapper_ewah_add_many(backend_bitmap_t *a, const uint32_t *x, long n)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	for (long i=0; i<n; i++)
+		b->set(x[i]);
+}
+
+void wrapper_ewah_free(backend_bitmap_t *a)
 {
 	delete reinterpret_cast<bitmap*>(a);	
 }
 
-wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+backend_bitmap_t *wrapper_ewah_and(backend_bitmap_t *a, backend_bitmap_t *b)
 {
 	bitmap *c = new bitmap;
 	reinterpret_cast<bitmap*>(a)->logicaland(*(reinterpret_cast<bitmap*>(b)), *c);
 	return c;
 }
 
-long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a)
+long wrapper_ewah_and_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return reinterpret_cast<bitmap*>(a)->logicalandcount(*(reinterpret_cast<bitmap*>(b)));
+}
+
+backend_bitmap_t *wrapper_ewah_andnot(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	bitmap *c = new bitmap;
+	reinterpret_cast<bitmap*>(a)->logicalandnot(*(reinterpret_cast<bitmap*>(b)), *c);
+	return c;
+}
+
+long wrapper_ewah_andnot_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return reinterpret_cast<bitmap*>(a)->logicalandnotcount(*(reinterpret_cast<bitmap*>(b)));
+}
+
+void wrapper_ewah_or_inplace(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	bitmap c;
+	reinterpret_cast<bitmap*>(a)->logicalor(*(reinterpret_cast<bitmap*>(b)), c);
+	reinterpret_cast<bitmap*>(a)->swap(c);
+}
+
+long wrapper_ewah_get_cardinality(backend_bitmap_t *a)
 {
 	return reinterpret_cast<bitmap*>(a)->numberOfOnes();	
 }
+
+// ewah has no random access. x becomes a bitmap of its own
+long wrapper_ewah_and_array(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out)
+{
+	bitmap b, c;
+	long k = 0;
+	for (long i=0; i<n; i++)
+		b.set(x[i]);
+	if (!out)
+		return reinterpret_cast<bitmap*>(a)->logicalandcount(b);
+	reinterpret_cast<bitmap*>(a)->logicaland(b, c);
+	for (bitmap::const_iterator i=c.begin(); i!=c.end(); ++i)
+		out[k++] = *i;
+	return k;
+}
+
+void wrapper_ewah_to_array(backend_bitmap_t *a, uint32_t *out)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	for (bitmap::const_iterator i=b->begin(); i!=b->end(); ++i)
+		*out++ = *i;
+}
+
+// ewah is compressed as it is built. only the room the buffer does not use is given back
+long wrapper_ewah_optimize(backend_bitmap_t *a)
+{
+	bitmap *b = reinterpret_cast<bitmap*>(a);
+	long size = b->getBuffer().capacity();
+	b->trim();
+	return (size-(long)b->getBuffer().capacity())*sizeof(uint64_t);
+}
+
+size_t wrapper_ewah_serialize_size(backend_bitmap_t *a)
+{
+	return 2*sizeof(size_t)+reinterpret_cast<bitmap*>(a)->sizeInBytes();
+}
+
+size_t wrapper_ewah_serialize(backend_bitmap_t *a, char *buf)
+{
+	return reinterpret_cast<bitmap*>(a)->write(buf, wrapper_ewah_serialize_size(a));
+}
+
+// read does not restore the position of the last marker word. the result is for reading only.
+// read sizes the buffer before it checks len, so the word count is checked here first, and
+// the marker words have to account for every word before the bitmap is used
+backend_bitmap_t *wrapper_ewah_deserialize(const char *buf, size_t len)
+{
+	size_t n, i;
+	bitmap *c = NULL;
+	
+	if (len < 2*sizeof(size_t))
+		return NULL;
+	memcpy(&n, buf+sizeof(size_t), sizeof(size_t));
+	if (n > (len-2*sizeof(size_t))/sizeof(uint64_t))
+		return NULL;
+	try
+	{
+		c = new bitmap;
+		if (c->read(buf, len) == 0)
+			goto e1;
+	}
+	catch (const std::exception &)
+	{
+		goto e1;
+	}
+	for (i=0; i<n; i+=1+ConstRunningLengthWord<uint64_t>(c->getBuffer()[i]).getNumberOfLiteralWords())
+		;
+	if (i != n)
+		goto e1;
+	return c;
+
+e1:
+	delete c;
+	return NULL;
+}
+
+const backend_t wrapper_ewah_backend =
+{
+	"ewah",
+	wrapper_ewah_create,
+	wrapper_ewah_free,
+	wrapper_ewah_add,
+	wrapper_ewah_add_many,
+	wrapper_ewah_and,
+	wrapper_ewah_and_cardinality,
+	wrapper_ewah_andnot,
+	wrapper_ewah_andnot_cardinality,
+	wrapper_ewah_or_inplace,
+	wrapper_ewah_get_cardinality,
+	wrapper_ewah_and_array,
+	wrapper_ewah_to_array,
+	wrapper_ewah_optimize,
+	wrapper_ewah_serialize_size,
+	wrapper_ewah_serialize,
+	wrapper_ewah_deserialize
+};
@@ -1,26 +1,115 @@
+#include "roaring.h"
 #include "wrapper.h"
 
-wrapped_bitmap_t *wrapped_bitmap_create()
+backend_bitmap_t *wrapper_roaring_create()
 {
 	return roaring_bitmap_create();
 }
 
-void wrapped_bitmap_add(wrapped_bitmap_t *a, uint32_t x)
+void wrapper_roaring_add(backend_bitmap_t *a, uint32_t x)
 {
 	roaring_bitmap_add(a, x);
 }
 
-void wrapped_bitmap_free(wrapped_bitmap_t *a)
+void wrapper_roaring_add_many(backend_bitmap_t *a, const uint32_t *x, long n)
+{
+	roaring_bitmap_add_many(a, n, x);
+}
+
+void wrapper_roaring_free(backend_bitmap_t *a)
 {
 	return roaring_bitmap_free(a);
 }
 
-wrapped_bitmap_t *wrapped_bitmap_and(wrapped_bitmap_t *a, wrapped_bitmap_t *b)
+backend_bitmap_t *wrapper_roaring_and(backend_bitmap_t *a, backend_bitmap_t *b)
 {
 	return roaring_bitmap_and(a, b);
 }
 
-long wrapped_bitmap_get_cardinality(wrapped_bitmap_t *a)
+long wrapper_roaring_and_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return roaring_bitmap_and_cardinality(a, b);
+}
+
+backend_bitmap_t *wrapper_roaring_andnot(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return roaring_bitmap_andnot(a, b);
+}
+
+long wrapper_roaring_andnot_cardinality(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	return roaring_bitmap_andnot_cardinality(a, b);
+}
+
+void wrapper_roaring_or_inplace(backend_bitmap_t *a, backend_bitmap_t *b)
+{
+	roaring_bitmap_or_inplace(a, b);
+}
+
+long wrapper_roaring_get_cardinality(backend_bitmap_t *a)
 {
 	return roaring_bitmap_get_cardinality(a);
 }
+
+long wrapper_roaring_and_array(backend_bitmap_t *a, const uint32_t *x, long n, uint32_t *out)
+{
+	long i, k = 0;
+	for (i=0; i<n; i++)
+		if (roaring_bitmap_contains(a, x[i]))
+		{
+			if (out)
+				out[k] = x[i];
+			k++;
+		}
+	return k;
+}
+
+void wrapper_roaring_to_array(backend_bitmap_t *a, uint32_t *out)
+{
+	roaring_bitmap_to_uint32_array(a, out);
+}
+
+// containers become runs where that is smaller, then all give back the room they do not use
+long wrapper_roaring_optimize(backend_bitmap_t *a)
+{
+	long size = roaring_bitmap_portable_size_in_bytes(a);
+	roaring_bitmap_run_optimize(a);
+	size -= roaring_bitmap_portable_size_in_bytes(a);
+	return size+roaring_bitmap_shrink_to_fit(a);
+}
+
+size_t wrapper_roaring_serialize_size(backend_bitmap_t *a)
+{
+	return roaring_bitmap_portable_size_in_bytes(a);
+}
+
+size_t wrapper_roaring_serialize(backend_bitmap_t *a, char *buf)
+{
+	return roaring_bitmap_portable_serialize(a, buf);
+}
+
+backend_bitmap_t *wrapper_roaring_deserialize(const char *buf, size_t len)
+{
+	return roaring_bitmap_portable_deserialize_safe(buf, len);
+}
+
+const backend_t wrapper_roaring_backend =
+{
+	"roaring",
+	wrapper_roaring_create,
+	wrapper_roaring_free,
+	wrapper_roaring_add,
+	wrapper_roaring_add_many,
+	wrapper_roaring_and,
+	wrapper_roaring_and_cardinality,
+	wrapper_roaring_andnot,
+	wrapper_roaring_andnot_cardinality,
+	wrapper_roaring_or_inplace,
+	wrapper_roaring_get_cardinality,
+	wrapper_roaring_and_array,
+	wrapper_roaring_to_array,
+	wrapper_roaring_optimize,
+	wrapper_roaring_serialize_size,
+	wrapper_roaring_serialize,
+	wrapper_roaring_deserialize
+};